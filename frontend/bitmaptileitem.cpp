@@ -0,0 +1,129 @@
+#include "bitmaptileitem.h"
+#include "pixelformat.h"
+#include <QtWidgets>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+// A multiple of 8, so the tiles of bilevel rows start at whole bytes
+constexpr int tileSize = 256;
+// Bounds the pixmaps held at once, a few screens worth of tiles
+constexpr int maxCachedKilobytes = 64 * 1024;
+} // namespace
+
+BitmapTileItem::BitmapTileItem(Bitmap *bitmap, QGraphicsItem *parent)
+    : QGraphicsItem(parent), tiles(maxCachedKilobytes) {
+  // the exposed rect tells which tiles are in view
+  setFlag(QGraphicsItem::ItemUsesExtendedStyleOption);
+  setBitmap(bitmap);
+}
+
+void BitmapTileItem::setBitmap(Bitmap *newBitmap) {
+  prepareGeometryChange();
+
+  bitmap = newBitmap;
+  bool hasOpenBitmap = bitmap && bitmap->hasOpenBitmap();
+  width = hasOpenBitmap ? bitmap->getWidth() : 0;
+  height = hasOpenBitmap ? bitmap->getHeight() : 0;
+
+  tiles.clear();
+  update();
+}
+
+void BitmapTileItem::setFrozen(bool isFrozen) { frozen = isFrozen; }
+
+QRectF BitmapTileItem::boundingRect() const {
+  return QRectF(0, 0, width, height);
+}
+
+void BitmapTileItem::paint(QPainter *painter,
+                           const QStyleOptionGraphicsItem *option, QWidget *) {
+  if (width == 0 || height == 0)
+    return;
+
+  // the pyramid level drawn at 1 to 2 screen pixels per tile pixel, the full resolution once zoomed in
+  qreal scale = QStyleOptionGraphicsItem::levelOfDetailFromTransform(
+      painter->worldTransform());
+  int level = 0;
+  while (scale * (2 << level) <= 1 && (tileSize << level) < std::max(width, height))
+    level++;
+
+  // the largest levels are left out of the pyramid when they don't fit the memory budget, the first one stored
+  // is drawn instead of them, or the bitmap itself if none is
+  if (level > 0) {
+    int firstLevel = ImagePyramid::getFirstLevel(width, height, bitmap->getPixelFormat());
+    level = firstLevel > 0 ? std::max(level, firstLevel) : 0;
+  }
+
+  int span = tileSize << level;
+  QRectF exposed = option->exposedRect.intersected(boundingRect());
+  if (exposed.isEmpty())
+    return;
+
+  int firstColumn = (int)exposed.left() / span;
+  int lastColumn = std::min((int)std::ceil(exposed.right()), width - 1) / span;
+  int firstRow = (int)exposed.top() / span;
+  int lastRow = std::min((int)std::ceil(exposed.bottom()), height - 1) / span;
+
+  for (int tileY = firstRow; tileY <= lastRow; tileY++) {
+    for (int tileX = firstColumn; tileX <= lastColumn; tileX++) {
+      quint64 key = getTileKey(level, tileX, tileY);
+      QPixmap tile;
+
+      // looking a tile up makes it the most recently used one
+      if (QPixmap *cached = tiles.object(key)) {
+        tile = *cached;
+      } else if (!frozen) {
+        tile = createTile(level, tileX, tileY);
+        tiles.insert(key, new QPixmap(tile),
+                     std::max(1, tile.width() * tile.height() * 4 / 1024));
+      } else {
+        continue;
+      }
+
+      int x = tileX * span;
+      int y = tileY * span;
+      QRectF target(x, y, std::min(span, width - x), std::min(span, height - y));
+      painter->drawPixmap(target, tile, QRectF(tile.rect()));
+    }
+  }
+}
+
+QPixmap BitmapTileItem::createTile(int level, int tileX, int tileY) {
+  // tiles cover tileSize pixels of their own level
+  int x0 = tileX * tileSize;
+  int y0 = tileY * tileSize;
+
+  // RGB pixels are packed like RGB888, so they are stored straight into the scanlines
+  if (level == 0) {
+    int tileWidth = std::min(tileSize, width - x0);
+    int tileHeight = std::min(tileSize, height - y0);
+    PIXEL_FORMAT format = bitmap->getPixelFormat();
+    unsigned maxValue = bitmap->getMaxValue();
+    QImage image(tileWidth, tileHeight, QImage::Format_RGB888);
+
+    for (int y = 0; y < tileHeight; y++)
+      PixelFormats::toPixels(bitmap->getRowData(y0 + y) + PixelFormats::getRowSize(x0, format),
+                             format, reinterpret_cast<Pixel *>(image.scanLine(y)), tileWidth,
+                             maxValue);
+
+    return QPixmap::fromImage(image);
+  }
+
+  // the pyramid is only recomputed over the regions changed since the last tiles were made
+  const ImagePyramid &pyramid = bitmap->getPyramid();
+  int tileWidth = std::min(tileSize, pyramid.getLevelWidth(level) - x0);
+  int tileHeight = std::min(tileSize, pyramid.getLevelHeight(level) - y0);
+  PIXEL_FORMAT format = pyramid.getLevelFormat();
+  QImage image(tileWidth, tileHeight, QImage::Format_RGB888);
+
+  for (int y = 0; y < tileHeight; y++)
+    PixelFormats::toPixels(pyramid.getRow(level, y0 + y) + PixelFormats::getRowSize(x0, format),
+                           format, reinterpret_cast<Pixel *>(image.scanLine(y)), tileWidth);
+
+  return QPixmap::fromImage(image);
+}
+
+quint64 BitmapTileItem::getTileKey(int level, int tileX, int tileY) {
+  return ((quint64)level << 56) | ((quint64)tileY << 28) | (quint64)tileX;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include "bitmap.h"
+#include <QCache>
+#include <QGraphicsItem>
+#include <QPixmap>
+
+// Draws a bitmap as square tiles, only the ones in view, at a resolution following the zoom of the view.
+// Zoomed out, the tiles come from the levels of the bitmap pyramid, so a whole image in view takes a few screens of pixels.
+// Tiles are made when first painted, and the least recently painted ones are dropped past a size limit.
+class BitmapTileItem : public QGraphicsItem {
+public:
+  BitmapTileItem(Bitmap *bitmap, QGraphicsItem *parent = nullptr);
+
+  // Shows given bitmap, or the same one after a change, dropping the tiles made so far.
+  void setBitmap(Bitmap *bitmap);
+
+  // While frozen, only the tiles made so far are painted, so the bitmap isn't read while an operation changes it.
+  void setFrozen(bool frozen);
+
+  QRectF boundingRect() const override;
+  void paint(QPainter *painter, const QStyleOptionGraphicsItem *option,
+             QWidget *widget = nullptr) override;
+
+private:
+  // Makes the tile at given column and row of a pyramid level. Each level halves the resolution of the previous one,
+  // so tiles of level n cover 2^n times more pixels of the bitmap.
+  QPixmap createTile(int level, int tileX, int tileY);
+  static quint64 getTileKey(int level, int tileX, int tileY);
+
+  Bitmap *bitmap;
+  int width = 0;
+  int height = 0;
+  bool frozen = false;
+  // Tiles by level and position, costing their size in kilobytes
+  QCache<quint64, QPixmap> tiles;
+};
@@ -61,24 +61,21 @@ void PamViewWindow::open() {
   auto filename = QFileDialog::getOpenFileName(
       this, tr("Open image"),
       QStandardPaths::writableLocation(QStandardPaths::PicturesLocation),
-      tr("Portable anymap (*.pbm *.pgm *.ppm)"));
+      tr("Portable anymap (*.pbm *.pgm *.ppm *.pam)"));
 
   if (!filename.isEmpty() && QFile::exists(filename)) {
-    std::ifstream stream(filename.toStdString());
-
     disableTopMenus();
 
     try {
-      getActiveBitmap()->openFromStream(
-          stream, std::bind(&PamViewWindow::handleProgress, this,
-                            std::placeholders::_1));
+      getActiveBitmap()->openFromFile(
+          filename.toStdString(), std::bind(&PamViewWindow::handleProgress,
+                                            this, std::placeholders::_1));
     } catch (std::exception) {
       handleLoadExceptions();
     }
 
     enableTopMenus();
 
-    stream.close();
     renderCanvas();
   }
 }
@@ -87,6 +84,16 @@ void PamViewWindow::saveP3() { showDialogAndSaveAs(P3); }
 
 void PamViewWindow::saveP6() { showDialogAndSaveAs(P6); }
 
+void PamViewWindow::saveP2() { showDialogAndSaveAs(P2); }
+
+void PamViewWindow::saveP5() { showDialogAndSaveAs(P5); }
+
+void PamViewWindow::saveP1() { showDialogAndSaveAs(P1); }
+
+void PamViewWindow::saveP4() { showDialogAndSaveAs(P4); }
+
+void PamViewWindow::saveP7() { showDialogAndSaveAs(P7); }
+
 void PamViewWindow::saveHelp() {
   QMessageBox::about(
       this, tr("File formats"),
@@ -104,7 +111,19 @@ void PamViewWindow::saveHelp() {
          "- fastest<br><br>"
 
          "Both are PPM (portable pixmap) formats, "
-         "meaning they store pixels as 24-bit RGB, aka truecolor."));
+         "meaning they store pixels as 24-bit RGB, aka truecolor.<br><br>"
+
+         "<b>Grayscale (P2, P5)</b>:<br>"
+         "- PGM (portable graymap), 8-bit gray values<br>"
+         "- a third of the color filesize, colors are lost<br><br>"
+
+         "<b>Black and white (P1, P4)</b>:<br>"
+         "- PBM (portable bitmap), 1 bit per pixel when binary<br>"
+         "- a 24th of the color filesize, only black and white are kept<br><br>"
+
+         "<b>PAM (P7)</b>:<br>"
+         "- PAM (portable arbitrary map), always binary<br>"
+         "- keeps the image as it is, including transparency"));
 }
 
 void PamViewWindow::closeBitmap() {
@@ -119,12 +138,16 @@ void PamViewWindow::undo() {
   renderCanvas();
 }
 
+void PamViewWindow::redo() {
+  getActiveBitmap()->redoLastChange();
+  renderCanvas();
+}
+
 void PamViewWindow::transformBrightness() {
   SliderDialog dialog(nullptr, "Adjust brightness");
 
   if (dialog.exec() == QDialog::Accepted) {
-    transformActiveBitmapAndRender(PixelTransformations::brightness,
-                                   dialog.getValue());
+    transformActiveBitmapAndRender(OP_BRIGHTNESS, dialog.getValue());
   }
 }
 
@@ -132,21 +155,20 @@ void PamViewWindow::transformSaturation() {
   SliderDialog dialog(nullptr, "Adjust saturation");
 
   if (dialog.exec() == QDialog::Accepted) {
-    transformActiveBitmapAndRender(PixelTransformations::saturation,
-                                   dialog.getValue());
+    transformActiveBitmapAndRender(OP_SATURATION, dialog.getValue());
   }
 }
 
 void PamViewWindow::transformNegative() {
-  transformActiveBitmapAndRender(PixelTransformations::negative);
+  transformActiveBitmapAndRender(OP_NEGATIVE);
 }
 
 void PamViewWindow::transformGrayscale() {
-  transformActiveBitmapAndRender(PixelTransformations::grayscale);
+  transformActiveBitmapAndRender(OP_GRAYSCALE);
 }
 
 void PamViewWindow::transformBlackAndWhite() {
-  transformActiveBitmapAndRender(PixelTransformations::blacknwhite);
+  transformActiveBitmapAndRender(OP_BLACKNWHITE);
 }
 
 void PamViewWindow::setFirstBitmap() { setActiveBitmap(FIRST_BITMAP); }
@@ -154,15 +176,15 @@ void PamViewWindow::setFirstBitmap() { setActiveBitmap(FIRST_BITMAP); }
 void PamViewWindow::setSecondBitmap() { setActiveBitmap(SECOND_BITMAP); }
 
 void PamViewWindow::sumBitmaps() {
-    combineActiveBitmapsAndShow(PixelCombinations::add);
+    combineActiveBitmapsAndShow(RowCombinations::add);
 }
 
 void PamViewWindow::diffBitmaps() {
-    combineActiveBitmapsAndShow(PixelCombinations::substract);
+    combineActiveBitmapsAndShow(RowCombinations::substract);
 }
 
 void PamViewWindow::multiplyBitmaps() {
-    combineActiveBitmapsAndShow(PixelCombinations::multiply);
+    combineActiveBitmapsAndShow(RowCombinations::multiply);
 }
 
 void PamViewWindow::bitmapDetails() {
@@ -174,21 +196,57 @@ void PamViewWindow::bitmapDetails() {
   int mbBitmap = memoryUsageBitmap / (1024 * 1024);
   int mbUndo = memoryUsageUndo / (1024 * 1024);
 
+  QString storage;
+  switch (getActiveBitmap()->getPixelFormat()) {
+  case FORMAT_GRAY:
+    storage = tr("grayscale, 8 bits per pixel");
+    break;
+  case FORMAT_BILEVEL:
+    storage = tr("black and white, 1 bit per pixel");
+    break;
+  case FORMAT_GRAY16:
+    storage = tr("grayscale, 16 bits per pixel");
+    break;
+  case FORMAT_RGB16:
+    storage = tr("RGB, 48 bits per pixel");
+    break;
+  case FORMAT_GRAY_ALPHA:
+    storage = tr("grayscale with alpha, 16 bits per pixel");
+    break;
+  case FORMAT_RGB_ALPHA:
+    storage = tr("RGB with alpha, 32 bits per pixel");
+    break;
+  case FORMAT_GRAY_ALPHA16:
+    storage = tr("grayscale with alpha, 32 bits per pixel");
+    break;
+  case FORMAT_RGB_ALPHA16:
+    storage = tr("RGB with alpha, 64 bits per pixel");
+    break;
+  default:
+    storage = tr("RGB, 24 bits per pixel");
+  }
+
+  // over the memory budget, the pixels are paged in from disk as needed
+  if (getActiveBitmap()->isOutOfCore())
+    storage += tr(", in a scratch file");
+
   QMessageBox::about(this, tr("Bitmap details"),
                      QStringLiteral("Details of the visible bitmap:\n\n"
                                     "Dimensions: %1*%2 px\n"
+                                    "Storage: %5\n"
                                     "Bitmap memory usage: ~%3MB\n"
                                     "Undo stack memory usage: ~%4MB")
                          .arg(width)
                          .arg(height)
                          .arg(mbBitmap)
-                         .arg(mbUndo));
+                         .arg(mbUndo)
+                         .arg(storage));
 }
 
 void PamViewWindow::showEvent(QShowEvent *event) {
   QMainWindow::showEvent(event);
   if (getActiveBitmap()->hasOpenBitmap())
-    canvas->fitInView(pixmapItem, Qt::KeepAspectRatio);
+    canvas->fitInView(bitmapItem, Qt::KeepAspectRatio);
 }
 
 void PamViewWindow::createActions() {
@@ -207,6 +265,26 @@ void PamViewWindow::createActions() {
   saveP6Act->setStatusTip(tr("Save in a P6 format (binary / raw)"));
   connect(saveP6Act, &QAction::triggered, this, &PamViewWindow::saveP6);
 
+  saveP2Act = new QAction(tr("ASCII &grayscale"), this);
+  saveP2Act->setStatusTip(tr("Save in a P2 format (ASCII grayscale)"));
+  connect(saveP2Act, &QAction::triggered, this, &PamViewWindow::saveP2);
+
+  saveP5Act = new QAction(tr("Binary g&rayscale"), this);
+  saveP5Act->setStatusTip(tr("Save in a P5 format (binary grayscale)"));
+  connect(saveP5Act, &QAction::triggered, this, &PamViewWindow::saveP5);
+
+  saveP1Act = new QAction(tr("ASCII black and &white"), this);
+  saveP1Act->setStatusTip(tr("Save in a P1 format (ASCII black and white)"));
+  connect(saveP1Act, &QAction::triggered, this, &PamViewWindow::saveP1);
+
+  saveP4Act = new QAction(tr("Binary black and wh&ite"), this);
+  saveP4Act->setStatusTip(tr("Save in a P4 format (binary black and white)"));
+  connect(saveP4Act, &QAction::triggered, this, &PamViewWindow::saveP4);
+
+  saveP7Act = new QAction(tr("&PAM"), this);
+  saveP7Act->setStatusTip(tr("Save in a P7 format (binary, keeps transparency)"));
+  connect(saveP7Act, &QAction::triggered, this, &PamViewWindow::saveP7);
+
   saveHelpAct = new QAction(QIcon::fromTheme(QIcon::ThemeIcon::HelpAbout),
                             tr("&How to pick"), this);
   saveHelpAct->setStatusTip(tr("Display the save help menu"));
@@ -230,6 +308,12 @@ void PamViewWindow::createActions() {
   undoAct->setStatusTip(tr("Undo the last operation"));
   connect(undoAct, &QAction::triggered, this, &PamViewWindow::undo);
 
+  redoAct = new QAction(QIcon::fromTheme(QIcon::ThemeIcon::EditRedo),
+                        tr("&Redo"), this);
+  redoAct->setShortcuts(QKeySequence::Redo);
+  redoAct->setStatusTip(tr("Redo the last undone operation"));
+  connect(redoAct, &QAction::triggered, this, &PamViewWindow::redo);
+
   // brightness
   transformBrightnessAct = new QAction(tr("&Brightness"), this);
   transformBrightnessAct->setStatusTip(tr("Adjust the image brightness"));
@@ -302,10 +386,20 @@ void PamViewWindow::createMenus() {
 
   saveMenu->addAction(saveP3Act);
   saveMenu->addAction(saveP6Act);
+  saveMenu->addSeparator();
+  saveMenu->addAction(saveP2Act);
+  saveMenu->addAction(saveP5Act);
+  saveMenu->addSeparator();
+  saveMenu->addAction(saveP1Act);
+  saveMenu->addAction(saveP4Act);
+  saveMenu->addSeparator();
+  saveMenu->addAction(saveP7Act);
+  saveMenu->addSeparator();
   saveMenu->addAction(saveHelpAct);
 
   editMenu = menuBar()->addMenu(tr("&Edit"));
   editMenu->addAction(undoAct);
+  editMenu->addAction(redoAct);
   transformMenu = editMenu->addMenu("&Transform");
 
   transformMenu->addAction(transformBrightnessAct);
@@ -334,6 +428,7 @@ void PamViewWindow::renderCanvas() {
   closeBitmapAct->setEnabled(hasOpenBitmap);
   saveMenu->setEnabled(hasOpenBitmap);
   undoAct->setEnabled(hasOpenBitmap && bitmap->canUndo());
+  redoAct->setEnabled(hasOpenBitmap && bitmap->canRedo());
 
   transformMenu->setEnabled(hasOpenBitmap);
 
@@ -342,44 +437,20 @@ void PamViewWindow::renderCanvas() {
   if (hasOpenBitmap) {
     int width = bitmap->getWidth();
     int height = bitmap->getHeight();
-    int totalPixels = width * height;
 
-    statusBar()->showMessage(tr("Rendering... %1\%").arg(0));
-    disableTopMenus();
-    QCoreApplication::processEvents();
-
-    QImage image(width, height, QImage::Format_RGB888);
-
-    int pixelNumber = 0;
-    for (int x = 0; x < width; x++) {
-      for (int y = 0; y < height; y++, pixelNumber++) {
-        if (pixelNumber % 10000 == 0) {
-          statusBar()->showMessage(
-              tr("Rendering... %1\%").arg((100 * pixelNumber) / totalPixels));
-          QCoreApplication::processEvents();
-        }
-
-        Pixel pixel = bitmap->getPixelAt(x, y);
-        image.setPixel(x, y, qRgb(pixel.r, pixel.g, pixel.b));
-      }
-    }
-
-    QPixmap pixmap = QPixmap::fromImage(image);
-
-    if (!pixmapItem) {
-      pixmapItem = new QGraphicsPixmapItem(pixmap);
-      scene->addItem(pixmapItem);
+    // tiles are made as they come into view, so nothing is rendered up front
+    if (!bitmapItem) {
+      bitmapItem = new BitmapTileItem(bitmap);
+      scene->addItem(bitmapItem);
     } else {
-      pixmapItem->setPixmap(pixmap);
+      bitmapItem->setBitmap(bitmap);
     }
 
     scene->setSceneRect(0, 0, width, height);
 
     stackedWidget->setCurrentWidget(canvas);
 
-    canvas->fitInView(pixmapItem, Qt::KeepAspectRatio);
-
-    enableTopMenus();
+    canvas->fitInView(bitmapItem, Qt::KeepAspectRatio);
 
     size_t memoryUsage = bitmap->getBitmapMemUsage();
     int memoryUsageMb = memoryUsage / (1024 * 1024);
@@ -388,9 +459,9 @@ void PamViewWindow::renderCanvas() {
                                  .arg(height)
                                  .arg(memoryUsageMb));
   } else {
-    if (pixmapItem) {
+    if (bitmapItem) {
       scene->clear();
-      pixmapItem = nullptr;
+      bitmapItem = nullptr;
     }
 
     stackedWidget->setCurrentWidget(noBitmapOpenWidget);
@@ -402,12 +473,19 @@ void PamViewWindow::disableTopMenus() {
   fileMenu->setEnabled(false);
   editMenu->setEnabled(false);
   dualBitmapMenu->setEnabled(false);
+
+  // the progress handlers process events, so the canvas may repaint while the bitmap changes
+  if (bitmapItem)
+    bitmapItem->setFrozen(true);
 }
 
 void PamViewWindow::enableTopMenus() {
   fileMenu->setEnabled(true);
   editMenu->setEnabled(true);
   dualBitmapMenu->setEnabled(true);
+
+  if (bitmapItem)
+    bitmapItem->setFrozen(false);
 }
 
 void PamViewWindow::displayError(QString message) {
@@ -420,13 +498,15 @@ void PamViewWindow::handleLoadExceptions() {
   } catch (unsupported_format_exception) {
     displayError(tr("This bitmap format (P-number) is not supported."));
   } catch (too_large_exception) {
-    displayError(tr("The bitmap is too large! Exceeded 100 000 000 pixels."));
+    displayError(tr("The bitmap is too large for the memory available."));
   } catch (bad_dimensions_exception) {
     displayError(tr("The bitmap has invalid dimensions"));
   } catch (unsupported_maxvalue_exception) {
     displayError(tr("This bitmap maxvalue is not yet supported."));
   } catch (stream_corrupt_exception) {
     displayError(tr("Could not load the bitmap. File may be corrupt"));
+  } catch (file_access_exception) {
+    displayError(tr("Could not open the file."));
   } catch (std::exception) {
     displayError(tr("Unrecognized error occured. Operation failed."));
   }
@@ -437,8 +517,6 @@ void PamViewWindow::handleSaveExceptions() {
     throw;
   } catch (unsupported_format_exception) {
     displayError(tr("Can't save to this format."));
-  } catch (too_large_exception) {
-    displayError(tr("The bitmap is too large to be saved."));
   } catch (no_bitmap_open_exception) {
     displayError(tr("No bitmap was open when trying to save."));
   } catch (std::exception) {
@@ -458,38 +536,30 @@ void PamViewWindow::handleCombineExceptions() {
   }
 }
 
-void PamViewWindow::transformActiveBitmapAndRender(
-    pixelTransformFunction transformFunction) {
+void PamViewWindow::transformActiveBitmapAndRender(TRANSFORM_OPERATION operation,
+                                                   int level) {
   disableTopMenus();
 
-  getActiveBitmap()->transformImage(
-      transformFunction,
-      std::bind(&PamViewWindow::handleProgress, this, std::placeholders::_1));
-
-  enableTopMenus();
+  progressHandlerType progressHandler =
+      std::bind(&PamViewWindow::handleProgress, this, std::placeholders::_1);
 
-  renderCanvas();
-}
-
-void PamViewWindow::transformActiveBitmapAndRender(
-    pixelTransformWithLevelFunction transformFunction, int level) {
-  disableTopMenus();
+  getActiveBitmap()->transform(operation, level, progressHandler);
 
-  getActiveBitmap()->transformImage(
-      transformFunction, level,
-      std::bind(&PamViewWindow::handleProgress, this, std::placeholders::_1));
+  // transform only records the operation, the pass runs here, while the menus
+  // and the canvas are frozen, and not on the next read of the pixels
+  getActiveBitmap()->applyPendingOperations(progressHandler);
 
   enableTopMenus();
 
   renderCanvas();
 }
 
-void PamViewWindow::combineActiveBitmapsAndShow(pixelCombinationFunction combineFunction) {
-    Bitmap* result = nullptr;
+void PamViewWindow::combineActiveBitmapsAndShow(rowCombinationFunction combineFunction) {
+    Bitmap* result = new Bitmap();
 
     try {
-        result = Bitmap::combineBitmaps(
-            bitmap1, bitmap2, combineFunction,
+        Bitmap::combineBitmaps(
+            *bitmap1, *bitmap2, *result, combineFunction,
             std::bind(&PamViewWindow::handleProgress, this, std::placeholders::_1)
         );
 
@@ -497,6 +567,7 @@ void PamViewWindow::combineActiveBitmapsAndShow(pixelCombinationFunction combine
         newWindow->show();
     }
     catch(std::exception) {
+        delete result;
         handleCombineExceptions();
     }
 }
@@ -505,10 +576,13 @@ void PamViewWindow::showDialogAndSaveAs(FILETYPE filetype) {
   auto filename = QFileDialog::getSaveFileName(
       this, tr("Save image"),
       QStandardPaths::writableLocation(QStandardPaths::PicturesLocation),
-      tr("Portable anymap (*.ppm)"));
+      filetype == P1 || filetype == P4   ? tr("Portable bitmap (*.pbm)")
+      : filetype == P2 || filetype == P5 ? tr("Portable graymap (*.pgm)")
+      : filetype == P7                   ? tr("Portable arbitrary map (*.pam)")
+                                         : tr("Portable pixmap (*.ppm)"));
 
   if (!filename.isEmpty()) {
-    std::ofstream stream(filename.toStdString());
+    std::ofstream stream(filename.toStdString(), std::ios::binary);
 
     disableTopMenus();
 
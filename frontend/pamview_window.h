@@ -5,6 +5,7 @@
 #define PAMVIEW_WINDOW_H
 
 #include "bitmap.h"
+#include "bitmaptileitem.h"
 #include "zoomablecanvas.h"
 #include <QMainWindow>
 
@@ -34,10 +35,16 @@ private slots:
   void open();
   void saveP3();
   void saveP6();
+  void saveP2();
+  void saveP5();
+  void saveP1();
+  void saveP4();
+  void saveP7();
   void saveHelp();
   void closeBitmap();
   void exit();
   void undo();
+  void redo();
   void transformBrightness();
   void transformSaturation();
   void transformNegative();
@@ -61,10 +68,8 @@ private:
   void handleLoadExceptions();
   void handleSaveExceptions();
   void handleCombineExceptions();
-  void transformActiveBitmapAndRender(pixelTransformFunction transformFunction);
-  void transformActiveBitmapAndRender(pixelTransformWithLevelFunction transformFunction,
-                                      int level);
-  void combineActiveBitmapsAndShow(pixelCombinationFunction combineFunction);
+  void transformActiveBitmapAndRender(TRANSFORM_OPERATION operation, int level = 0);
+  void combineActiveBitmapsAndShow(rowCombinationFunction combineFunction);
   void showDialogAndSaveAs(FILETYPE filetype);
   void setupNoBitmapOpenWidget();
   void handleProgress(int progress);
@@ -83,10 +88,16 @@ private:
   QAction *openAct;
   QAction *saveP3Act;
   QAction *saveP6Act;
+  QAction *saveP2Act;
+  QAction *saveP5Act;
+  QAction *saveP1Act;
+  QAction *saveP4Act;
+  QAction *saveP7Act;
   QAction *saveHelpAct;
   QAction *closeBitmapAct;
   QAction *exitAct;
   QAction *undoAct;
+  QAction *redoAct;
   QAction *transformBrightnessAct;
   QAction *transformSaturationAct;
   QAction *transformNegativeAct;
@@ -103,7 +114,7 @@ private:
   QLabel *noBitmapLabel = nullptr;
   ZoomableCanvas *canvas = nullptr;
   QGraphicsScene *scene = nullptr;
-  QGraphicsPixmapItem *pixmapItem = nullptr;
+  BitmapTileItem *bitmapItem = nullptr;
   QImage image;
 };
 
@@ -0,0 +1,73 @@
+#include "asciiscanner.h"
+#include "exceptions.h"
+#include <cstring>
+#define READ_BLOCK_SIZE (1 << 20)
+
+AsciiScanner::AsciiScanner(const char *begin, const char *end) : position(begin), end(end) {}
+
+AsciiScanner::AsciiScanner(std::istream &stream) : stream(&stream), buffer(READ_BLOCK_SIZE)
+{
+    position = end = buffer.data();
+}
+
+size_t AsciiScanner::countValues(bool bits)
+{
+    size_t count = 0;
+
+    while (skipSeparators())
+    {
+        if (bits)
+        {
+            position++;
+        }
+        else
+        {
+            while (position < end && isDigit(*position))
+                position++;
+        }
+        count++;
+    }
+
+    return count;
+}
+
+void AsciiScanner::skipComment()
+{
+    // comments last until the end of line
+    while (true)
+    {
+        const char *lineEnd = static_cast<const char *>(std::memchr(position, '\n', end - position));
+
+        if (lineEnd)
+        {
+            position = lineEnd + 1;
+            return;
+        }
+
+        position = end;
+        if (!refill())
+            return;
+    }
+}
+
+bool AsciiScanner::refill()
+{
+    if (!stream || !*stream)
+        return position < end;
+
+    // keep the unread characters, and read behind them
+    size_t remaining = end - position;
+    std::memmove(buffer.data(), position, remaining);
+
+    stream->read(buffer.data() + remaining, buffer.size() - remaining);
+
+    position = buffer.data();
+    end = buffer.data() + remaining + stream->gcount();
+
+    return position < end;
+}
+
+void AsciiScanner::throwUnexpectedCharacter()
+{
+    throw stream_corrupt_exception("Unexpected character in ASCII pixel data");
+}
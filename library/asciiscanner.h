@@ -0,0 +1,102 @@
+#pragma once
+#include <cstddef>
+#include <istream>
+#include <vector>
+
+// Reads unsigned decimal values from ASCII PNM pixel data, skipping whitespace and comments.
+// Works either directly on a memory range, or on a stream read in large blocks.
+class AsciiScanner {
+    public:
+        // Scans the characters in [begin, end).
+        AsciiScanner(const char *begin, const char *end);
+
+        // Scans the rest of the stream.
+        AsciiScanner(std::istream &stream);
+
+        // Reads the next decimal value. Returns false if the data ended before it. Throws stream_corrupt_exception on anything else than digits.
+        bool readValue(unsigned &value)
+        {
+            if (!skipSeparators())
+                return false;
+
+            if (!isDigit(*position))
+                throwUnexpectedCharacter();
+
+            unsigned result = 0;
+            const char *firstDigit = position;
+
+            while (position < end && isDigit(*position))
+            {
+                result = result * 10 + (*position - '0');
+                position++;
+            }
+
+            if (position - firstDigit > MAX_DIGITS)
+                throwUnexpectedCharacter();
+
+            value = result;
+            return true;
+        }
+
+        // Reads the next bit of a plain PBM (P1), where the whitespace between bits is optional.
+        bool readBit(unsigned &value)
+        {
+            if (!skipSeparators())
+                return false;
+
+            if (*position != '0' && *position != '1')
+                throwUnexpectedCharacter();
+
+            value = *position++ - '0';
+            return true;
+        }
+
+        // Counts the values (or bits) left, without decoding them.
+        size_t countValues(bool bits);
+    private:
+        static const int MAX_DIGITS = 9;
+
+        static bool isDigit(char c)
+        {
+            return c >= '0' && c <= '9';
+        }
+
+        static bool isWhitespace(char c)
+        {
+            return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' || c == '\f';
+        }
+
+        // Moves to the next character which is not a separator. Returns false at the end of data.
+        bool skipSeparators()
+        {
+            while (true)
+            {
+                if (position == end && !refill())
+                    return false;
+
+                char c = *position;
+
+                if (isWhitespace(c))
+                    position++;
+                else if (c == '#')
+                    skipComment();
+                else
+                    break;
+            }
+
+            // make sure a whole value is in the buffer
+            if (stream && end - position <= MAX_DIGITS)
+                refill();
+
+            return true;
+        }
+
+        void skipComment();
+        bool refill();
+        [[noreturn]] void throwUnexpectedCharacter();
+
+        const char *position;
+        const char *end;
+        std::istream *stream = nullptr;
+        std::vector<char> buffer;
+};
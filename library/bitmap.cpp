@@ -1,27 +1,197 @@
 #include "bitmap.h"
+#include "channelkernels.h"
 #include "exceptions.h"
+#include "mappedfile.h"
 #include "parser.h"
+#include "tilecodec.h"
+#include "transformpipeline.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
 #include <functional>
-#define MAX_PIXELS 100000000
-#define PROGRESS_BAR_UPDATE_TRESHOLD 10000
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#define BITMAP_ALIGNMENT 64
+#define UNDO_TILE_SIZE 64
+#define DEFAULT_UNDO_MEMORY_LIMIT ((size_t)1 << 30)
+#define COMPRESS_IN_BACKGROUND_MIN_BYTES (1 << 20)
+#define FALLBACK_MEMORY_BUDGET ((size_t)4 << 30)
+#define MAX_REPLAYED_OPERATIONS 8
+
+namespace {
+    // Returns the size of the physical memory, or the fallback budget if it can't be told
+    size_t getPhysicalMemorySize()
+    {
+#ifdef _WIN32
+        MEMORYSTATUSEX status;
+        status.dwLength = sizeof(status);
+        if (GlobalMemoryStatusEx(&status))
+            return (size_t)status.ullTotalPhys;
+#else
+        long pages = sysconf(_SC_PHYS_PAGES);
+        long pageSize = sysconf(_SC_PAGE_SIZE);
+        if (pages > 0 && pageSize > 0)
+            return (size_t)pages * pageSize;
+#endif
+        return FALLBACK_MEMORY_BUDGET;
+    }
+
+    // Returns the system temporary directory, or an empty path if there is none
+    std::string getTemporaryDirectory()
+    {
+        std::error_code error;
+        std::filesystem::path directory = std::filesystem::temp_directory_path(error);
+        return error ? std::string() : directory.string();
+    }
+
+    // The bytes of an image covered by an undo tile: rowCount rows of rowBytes bytes, the first one starting at offset
+    struct TileSpan
+    {
+        size_t offset;
+        size_t rowBytes;
+        int rowCount;
+        size_t stride;
+    };
+
+    // Returns the number of tiles along a side of given length in pixels
+    int getTileCount(int length)
+    {
+        return (length + UNDO_TILE_SIZE - 1) / UNDO_TILE_SIZE;
+    }
+
+    size_t getTileCount(int width, int height)
+    {
+        return (size_t)getTileCount(width) * getTileCount(height);
+    }
+
+    // Tiles are UNDO_TILE_SIZE pixels wide, a whole number of bytes even for bilevel rows
+    TileSpan getTileSpan(int width, int height, PIXEL_FORMAT format, size_t tileIndex)
+    {
+        int tileX = tileIndex % getTileCount(width);
+        int tileY = tileIndex / getTileCount(width);
+        size_t stride = PixelFormats::getRowSize(width, format);
+        size_t begin = PixelFormats::getRowSize(tileX * UNDO_TILE_SIZE, format);
+        size_t end = std::min(PixelFormats::getRowSize((tileX + 1) * UNDO_TILE_SIZE, format), stride);
+        int firstRow = tileY * UNDO_TILE_SIZE;
+
+        return { firstRow * stride + begin, end - begin, std::min(UNDO_TILE_SIZE, height - firstRow), stride };
+    }
+
+    void copyTileFrom(const uint8_t *image, const TileSpan &span, std::vector<uint8_t> &tile)
+    {
+        tile.resize(span.rowBytes * span.rowCount);
+        for (int row = 0; row < span.rowCount; row++)
+            std::memcpy(tile.data() + row * span.rowBytes, image + span.offset + row * span.stride, span.rowBytes);
+    }
+
+    void copyTileInto(uint8_t *image, const TileSpan &span, const std::vector<uint8_t> &tile)
+    {
+        for (int row = 0; row < span.rowCount; row++)
+            std::memcpy(image + span.offset + row * span.stride, tile.data() + row * span.rowBytes, span.rowBytes);
+    }
+}
+
+std::atomic<size_t> Bitmap::memoryBudget(getPhysicalMemorySize());
+std::string Bitmap::scratchDirectory = getTemporaryDirectory();
+std::mutex Bitmap::scratchDirectoryMutex;
 
 int Bitmap::getWidth() { return width; }
 int Bitmap::getHeight() { return height; }
 size_t Bitmap::getBitmapMemUsage()
 {
-    return hasOpenBitmap() ? getMapMemoryUsage(width, height) : 0;
+    return hasOpenBitmap() ? getMapMemoryUsage(width, height, format) : 0;
 }
 size_t Bitmap::getUndoStackMemUsage()
 {
-    return previousBitmapState.has_value() ? getMapMemoryUsage(previousBitmapState->width, previousBitmapState->height) : 0;
+    waitForCompression();
+
+    size_t usage = 0;
+    for (const SavedBitmapState &state : undoStates)
+        usage += state.savedBytes;
+    for (const SavedBitmapState &state : redoStates)
+        usage += state.savedBytes;
+
+    return usage;
+}
+void Bitmap::setUndoMemoryLimit(size_t bytes)
+{
+    undoMemoryLimit = bytes;
+    waitForCompression();
+
+    if (bytes == 0)
+    {
+        applyPendingOperations();
+        clearUndoHistory();
+    }
+    else
+    {
+        dropOldestStates();
+    }
+}
+size_t Bitmap::getUndoMemoryLimit()
+{
+    return undoMemoryLimit;
 }
 size_t Bitmap::getTotalMemUsage()
 {
     return getBitmapMemUsage() + getUndoStackMemUsage();
 }
+void Bitmap::setMemoryBudget(size_t bytes)
+{
+    memoryBudget = bytes;
+}
+size_t Bitmap::getMemoryBudget()
+{
+    return memoryBudget;
+}
+void Bitmap::setScratchDirectory(const std::string &directory)
+{
+    std::lock_guard<std::mutex> lock(scratchDirectoryMutex);
+    scratchDirectory = directory;
+}
+std::string Bitmap::getScratchDirectory()
+{
+    std::lock_guard<std::mutex> lock(scratchDirectoryMutex);
+    return scratchDirectory;
+}
+void Bitmap::checkMemoryBudget(int width, int height, PIXEL_FORMAT format)
+{
+    if (height <= 0)
+        return;
+
+    // compared row by row, the byte count of absurd dimensions doesn't fit 64 bits
+    size_t rowSize = PixelFormats::getRowSize(width, format);
+    if (rowSize > SIZE_MAX / height)
+        throw too_large_exception("The bitmap doesn't fit the address space");
+
+    if (rowSize > memoryBudget / height && getScratchDirectory().empty())
+        throw too_large_exception("The bitmap exceeds the memory budget");
+}
+bool Bitmap::isOutOfCore()
+{
+    return mappedFile && mappedFile->getMode() == MAPPING_SCRATCH;
+}
 bool Bitmap::hasOpenBitmap()
 {
-    return map != nullptr;
+    return data != nullptr;
+}
+PIXEL_FORMAT Bitmap::getPixelFormat()
+{
+    return format;
+}
+int Bitmap::getMaxValue()
+{
+    return maxValue;
 }
 Pixel Bitmap::getPixelAt(int x, int y)
 {
@@ -29,46 +199,97 @@ Pixel Bitmap::getPixelAt(int x, int y)
         throw std::invalid_argument("Provided coordinantes are outside the bitmap");
     if (!hasOpenBitmap())
         throw std::invalid_argument("No bitmap is open");
-    return map[x][y];
+
+    applyPendingOperations();
+    return getPixelAtFast(x, y);
 }
 
 Pixel Bitmap::getPixelAtFast(int x, int y)
 {
-    return map[x][y];
+    return PixelFormats::getPixel(getRowData(y), format, x, maxValue);
 }
 
 bool Bitmap::setPixelAt(int x, int y, Pixel newPixel, bool skipCommit)
 {
     if (!hasPoint(x, y) || !hasOpenBitmap())
         return false;
+
+    applyPendingOperations();
     if (!skipCommit)
         commitPreChange();
-    map[x][y] = newPixel;
+    if (!PixelFormats::canRepresent(newPixel, format))
+        changeFormat(PixelFormats::getColorFormat(format));
+    saveRegion(x, y, 1, 1);
+    setPixelAtFast(x, y, newPixel);
     return true;
 }
 
 void Bitmap::setPixelAtFast(int x, int y, Pixel newPixel)
 {
-    map[x][y] = newPixel;
+    PixelFormats::setPixel(getRowData(y), format, x, newPixel, maxValue);
+}
+
+Pixel *Bitmap::getRow(int y)
+{
+    applyPendingOperations();
+    return reinterpret_cast<Pixel *>(getRowData(y));
+}
+
+uint8_t *Bitmap::getRowData(int y)
+{
+    return data + y * getStride();
+}
+
+void Bitmap::readRows(int firstRow, int rowCount, Pixel *destination)
+{
+    applyPendingOperations();
+    for (int y = 0; y < rowCount; y++)
+        PixelFormats::toPixels(getRowData(firstRow + y), format, destination + (size_t)y * width, width, maxValue);
 }
 
-void Bitmap::createBlank(int newWidth, int newHeight, Pixel defaultFill)
+const ImagePyramid &Bitmap::getPyramid()
 {
-    if (newWidth == width && newHeight == height && hasOpenBitmap())
+    // rows read halfway through a pass would be marked as up to date
+    if (applyingOperation || WorkerPool::getInstance().isInsideJob())
+        throw std::logic_error("The pyramid can't be updated while the bitmap is being changed");
+
+    // the recorded operations mark the pyramid once they are applied
+    applyPendingOperations();
+    pyramid.update(*this);
+    return pyramid;
+}
+
+size_t Bitmap::getStride()
+{
+    return PixelFormats::getRowSize(width, format);
+}
+
+void Bitmap::createBlank(int newWidth, int newHeight, Pixel defaultFill, PIXEL_FORMAT newFormat, int newMaxValue)
+{
+    if (!PixelFormats::isDeep(newFormat))
+        newMaxValue = newFormat == FORMAT_BILEVEL ? 1 : 255;
+    else if (newMaxValue <= 0 || newMaxValue > UINT16_MAX)
+        newMaxValue = UINT16_MAX;
+
+    if (newWidth == width && newHeight == height && newFormat == format && newMaxValue == maxValue && hasOpenBitmap())
     {
-        fillWithColor(defaultFill, true);
         clearUndoHistory();
+        fillWithColor(defaultFill, true);
         return;
     }
     if (newWidth > 0 && newHeight > 0)
     {
+        // checked before anything is dropped, so a refused bitmap leaves the current one as it is
+        checkMemoryBudget(newWidth, newHeight, newFormat);
+        clearUndoHistory();
         freeMemory();
         width = newWidth;
         height = newHeight;
+        format = newFormat;
+        maxValue = newMaxValue;
         allocateBitmapMemory(width, height);
 
         fillWithColor(defaultFill, true);
-        clearUndoHistory();
     }
     else
     {
@@ -78,12 +299,15 @@ void Bitmap::createBlank(int newWidth, int newHeight, Pixel defaultFill)
 
 void Bitmap::freeMemory()
 {
+    pyramid.clear();
+
     if (hasOpenBitmap())
     {
-        for (int x = 0; x < width; x++)
-            delete[] map[x];
-        delete[] map;
-        map = nullptr;
+        if (mappedFile)
+            mappedFile.reset();
+        else
+            freeData(data);
+        data = nullptr;
         width = 0;
         height = 0;
     }
@@ -91,60 +315,583 @@ void Bitmap::freeMemory()
 
 void Bitmap::allocateBitmapMemory(int width, int height)
 {
-    map = new Pixel *[width];
-    for (int x = 0; x < width; x++)
+    data = allocatePixels(width, height, format, mappedFile);
+}
+
+uint8_t *Bitmap::allocateData(size_t size)
+{
+    return static_cast<uint8_t *>(::operator new(size, std::align_val_t(BITMAP_ALIGNMENT)));
+}
+
+uint8_t *Bitmap::allocatePixels(int width, int height, PIXEL_FORMAT format, std::shared_ptr<MappedFile> &file)
+{
+    checkMemoryBudget(width, height, format);
+
+    size_t size = PixelFormats::getRowSize(width, format) * height;
+    if (size <= memoryBudget)
+        return allocateData(size);
+
+    try
+    {
+        file = std::make_shared<MappedFile>(size, getScratchDirectory());
+    }
+    catch (file_access_exception &)
+    {
+        throw too_large_exception("The bitmap exceeds the memory budget, and could not be stored in a scratch file");
+    }
+
+    // mappings start at a page boundary, aligned well beyond BITMAP_ALIGNMENT
+    return reinterpret_cast<uint8_t *>(file->getWritableData());
+}
+
+void Bitmap::freeData(uint8_t *data)
+{
+    ::operator delete(data, std::align_val_t(BITMAP_ALIGNMENT));
+}
+
+void Bitmap::copyPixels(const char *pixels, int newWidth, int newHeight, PIXEL_FORMAT newFormat, progressHandlerType progressHandler)
+{
+    // checked before anything is dropped, so a refused bitmap leaves the current one as it is
+    checkMemoryBudget(newWidth, newHeight, newFormat);
+    clearUndoHistory();
+    freeMemory();
+
+    width = newWidth;
+    height = newHeight;
+    format = newFormat;
+    maxValue = newFormat == FORMAT_BILEVEL ? 1 : 255;
+    allocateBitmapMemory(width, height);
+
+    size_t stride = PixelFormats::getRowSize(width, format);
+
+    WorkerPool::getInstance().forEachRowBand(height, [&](int firstRow, int lastRow) {
+        std::memcpy(data + firstRow * stride, pixels + firstRow * stride, (lastRow - firstRow) * stride);
+    }, progressHandler);
+}
+
+void Bitmap::convertToFormat(PIXEL_FORMAT newFormat)
+{
+    applyPendingOperations();
+    if (!hasOpenBitmap() || newFormat == format)
+        return;
+
+    commitPreChange();
+    changeFormat(newFormat);
+}
+
+void Bitmap::changeFormat(PIXEL_FORMAT newFormat)
+{
+    if (newFormat == format)
+        return;
+
+    // undo tiles hold the old format, so all of them are needed
+    saveAllTiles();
+
+    // the maxvalue of deep formats is kept as long as the depth is, 8-bit values widen without scaling
+    int newMaxValue = PixelFormats::isDeep(newFormat) ? (PixelFormats::isDeep(format) ? maxValue : 255) : (newFormat == FORMAT_BILEVEL ? 1 : 255);
+    int conversionMaxValue = PixelFormats::isDeep(format) ? maxValue : newMaxValue;
+
+    std::shared_ptr<MappedFile> newFile;
+    uint8_t *newData = allocatePixels(width, height, newFormat, newFile);
+    size_t newStride = PixelFormats::getRowSize(width, newFormat);
+
+    WorkerPool::getInstance().forEachRowBand(height, [&](int firstRow, int lastRow) {
+        for (int y = firstRow; y < lastRow; y++)
+            PixelFormats::convertRow(getRowData(y), format, newData + y * newStride, newFormat, width, conversionMaxValue);
+    });
+
+    if (!mappedFile)
+        freeData(data);
+
+    data = newData;
+    mappedFile = newFile;
+    maxValue = newMaxValue;
+    format = newFormat;
+}
+
+void Bitmap::transform(TRANSFORM_OPERATION operation, int level, progressHandlerType progressHandler)
+{
+    if (!hasOpenBitmap())
+        return;
+
+    pushUndoState();
+
+    // there is no state when the history is off
+    if (!undoStates.empty())
     {
-        map[x] = new Pixel[height];
+        // negative is its own inverse, the other operations are replayed from the last checkpoint while it is close enough,
+        // otherwise the step saves the whole image and becomes the next checkpoint
+        if (operation == OP_NEGATIVE)
+        {
+            undoStates.back().method = UNDO_INVERT;
+        }
+        else if (canReplay())
+        {
+            undoStates.back().method = UNDO_REPLAY;
+        }
+        else
+        {
+            // the checkpoint holds the image right before the operation, with the earlier ones applied
+            applyPendingOperations(progressHandler);
+            saveAllTiles();
+        }
     }
+
+    // saveAllTiles ends the history when the checkpoint doesn't fit it
+    if (!undoStates.empty())
+    {
+        SavedBitmapState &state = undoStates.back();
+        state.hasOperation = true;
+        state.operation = operation;
+        state.level = level;
+    }
+
+    // the operation runs with the ones recorded after it, once the pixels are needed
+    pendingOperations.add(operation, level);
 }
 
-void Bitmap::freePreviousBitmapStateMemory()
+void Bitmap::applyPendingOperations(progressHandlerType progressHandler)
 {
-    if (previousBitmapState.has_value() && previousBitmapState->map != nullptr)
+    if (pendingOperations.isEmpty())
+        return;
+
+    // nothing is pending anymore by the time the pixels are accessed to apply the operations
+    TransformPipeline pipeline;
+    std::swap(pipeline, pendingOperations);
+
+    applyPipeline(pipeline, progressHandler);
+}
+
+void Bitmap::applyPipeline(TransformPipeline &pipeline, progressHandlerType progressHandler)
+{
+    // journaled operations save no tiles
+    pyramid.invalidate();
+    applyingOperation = true;
+
+    try
     {
-        int width = previousBitmapState->width;
+        pipeline.compile();
 
-        for (int x = 0; x < width; x++)
+        if (!PixelFormats::isDeep(format))
         {
-            delete[] previousBitmapState->map[x];
+            applyRows([&pipeline](Pixel *row, int width) { pipeline.applyToRow(row, width); }, progressHandler);
         }
+        else
+        {
+            if (progressHandler)
+                progressHandler(0);
+
+            int channels = PixelFormats::getChannelCount(format);
 
-        delete[] previousBitmapState->map;
+            WorkerPool::getInstance().forEachRowBand(height, [&](int firstRow, int lastRow) {
+                for (int y = firstRow; y < lastRow; y++)
+                    pipeline.applyToChannels(reinterpret_cast<uint16_t *>(getRowData(y)), width, channels, maxValue);
+            }, progressHandler);
 
-        previousBitmapState->map = nullptr;
+            if (progressHandler)
+                progressHandler(100);
+        }
     }
+    catch (...)
+    {
+        applyingOperation = false;
+        throw;
+    }
+
+    applyingOperation = false;
+}
+
+bool Bitmap::applyGrayLevels(const Pixel *levels, progressHandlerType progressHandler)
+{
+    // bilevel images only hold black and white, the other levels don't matter
+    int levelStep = format == FORMAT_BILEVEL ? 255 : 1;
+
+    for (int value = 0; value < 256; value += levelStep)
+    {
+        if (!PixelFormats::canRepresent(levels[value], FORMAT_GRAY))
+            return false;
+    }
+
+    if (format == FORMAT_BILEVEL && !(PixelFormats::canRepresent(levels[0], FORMAT_BILEVEL) && PixelFormats::canRepresent(levels[255], FORMAT_BILEVEL)))
+        changeFormat(FORMAT_GRAY);
+
+    if (format != FORMAT_BILEVEL)
+    {
+        uint8_t table[256];
+        for (int value = 0; value < 256; value++)
+            table[value] = levels[value].r;
+
+        // the gray value is the first channel, followed by the untouched alpha if any
+        int channels = PixelFormats::getChannelCount(format);
+
+        WorkerPool::getInstance().forEachRowBand(height, [this, &table, channels](int firstRow, int lastRow) {
+            for (int y = firstRow; y < lastRow; y++)
+            {
+                uint8_t *row = getRowData(y);
+                for (size_t x = 0; x < (size_t)width * channels; x += channels)
+                    row[x] = table[row[x]];
+            }
+        }, progressHandler);
+    }
+    else
+    {
+        // black (1) and white (0) bits each turn into black or white, so whole bytes are kept, inverted or set
+        uint8_t blackBits = levels[0].r == 0 ? 0xFF : 0x00;
+        uint8_t whiteBits = levels[255].r == 0 ? 0xFF : 0x00;
+        size_t stride = getStride();
+
+        WorkerPool::getInstance().forEachRowBand(height, [this, stride, blackBits, whiteBits](int firstRow, int lastRow) {
+            for (int y = firstRow; y < lastRow; y++)
+            {
+                uint8_t *row = getRowData(y);
+                for (size_t i = 0; i < stride; i++)
+                    row[i] = (row[i] & blackBits) | (~row[i] & whiteBits);
+            }
+        }, progressHandler);
+    }
+
+    return true;
 }
 
 void Bitmap::commitPreChange()
 {
-    if (!hasOpenBitmap())
+    // the new step comes after the transformations recorded so far
+    applyPendingOperations();
+    pushUndoState();
+}
+
+void Bitmap::pushUndoState()
+{
+    if (!hasOpenBitmap() || undoMemoryLimit == 0)
         return;
-    if (!previousBitmapState.has_value())
-        previousBitmapState = SavedBitmapState(nullptr, width, height);
 
-    freePreviousBitmapStateMemory();
+    waitForCompression();
+    clearRedoStates();
+
+    // nothing is copied yet, the tiles are saved as they are about to change
+    undoStates.emplace_back(width, height, format, maxValue);
+    dropOldestStates();
 
-    previousBitmapState->map = new Pixel *[width];
+    // the previous step is complete, so it is compressed while the new one runs
+    if (undoStates.size() > 1)
+        compressInBackground(undoStates[undoStates.size() - 2]);
+}
+
+SavedBitmapState *Bitmap::getChangeState()
+{
+    // a journaled operation saves nothing, its step is undone by inverting or replaying it
+    if (applyingOperation)
+        return nullptr;
+
+    applyPendingOperations();
+
+    // any change makes the undone steps unreachable
+    clearRedoStates();
+
+    if (undoStates.empty())
+        return nullptr;
+
+    // a change merged into a journaled step (skipCommit) needs tiles, so it becomes a step of its own
+    if (undoStates.back().method != UNDO_RESTORE_TILES)
+        commitPreChange();
 
-    for (int x = 0; x < width; x++)
+    // replaying the operation of a checkpoint wouldn't redo the merged change
+    SavedBitmapState &state = undoStates.back();
+    state.hasOperation = false;
+
+    if (state.compressed)
+        decompressState(state);
+
+    return &state;
+}
+
+void Bitmap::saveRegion(int x, int y, int regionWidth, int regionHeight)
+{
+    // the pyramid follows every change, even with the history off
+    pyramid.invalidate(x, y, regionWidth, regionHeight);
+
+    SavedBitmapState *changeState = getChangeState();
+    if (!changeState)
+        return;
+
+    SavedBitmapState &state = *changeState;
+    int tileColumns = getTileCount(width);
+
+    for (int tileY = y / UNDO_TILE_SIZE; tileY <= (y + regionHeight - 1) / UNDO_TILE_SIZE; tileY++)
     {
-        previousBitmapState->map[x] = new Pixel[height];
-        for (int y = 0; y < height; y++)
+        for (int tileX = x / UNDO_TILE_SIZE; tileX <= (x + regionWidth - 1) / UNDO_TILE_SIZE; tileX++)
         {
-            previousBitmapState->map[x][y] = map[x][y];
+            size_t index = (size_t)tileY * tileColumns + tileX;
+
+            // a tile is saved before its first change only, later changes are part of the same step
+            if (state.tiles.count(index))
+                continue;
+
+            std::vector<uint8_t> &tile = state.tiles[index];
+            copyTileFrom(data, getTileSpan(width, height, format, index), tile);
+            state.savedBytes += tile.size();
         }
     }
 }
 
+void Bitmap::saveAllTiles()
+{
+    pyramid.invalidate();
+
+    SavedBitmapState *changeState = getChangeState();
+    if (!changeState)
+        return;
+
+    // a copy of the whole image would bring into memory what the scratch file keeps out of it, so the change can't be undone,
+    // and neither can the steps before it. Negatives and edits of regions stay undoable.
+    if (isOutOfCore() && getMapMemoryUsage(width, height, format) > undoMemoryLimit)
+    {
+        clearUndoHistory();
+        return;
+    }
+
+    SavedBitmapState &state = *changeState;
+    size_t tileCount = getTileCount(width, height);
+
+    if (state.tiles.size() == tileCount)
+        return;
+
+    // the missing tiles are created first, so the copies can run in parallel without touching the map
+    std::vector<size_t> missing;
+    for (size_t index = 0; index < tileCount; index++)
+    {
+        if (!state.tiles.count(index))
+            missing.push_back(index);
+    }
+
+    std::vector<std::vector<uint8_t> *> tiles;
+    for (size_t index : missing)
+        tiles.push_back(&state.tiles[index]);
+
+    WorkerPool::getInstance().forEachRowBand(missing.size(), [&](int first, int last) {
+        for (int i = first; i < last; i++)
+            copyTileFrom(data, getTileSpan(width, height, format, missing[i]), *tiles[i]);
+    });
+
+    for (std::vector<uint8_t> *tile : tiles)
+        state.savedBytes += tile->size();
+}
+
 void Bitmap::clearUndoHistory()
 {
-    freePreviousBitmapStateMemory();
-    previousBitmapState.reset();
+    // the recorded operations are steps of the history too
+    pendingOperations.clear();
+    waitForCompression();
+    undoStates.clear();
+    redoStates.clear();
 }
 
-size_t Bitmap::getMapMemoryUsage(int width, int height)
+void Bitmap::clearRedoStates()
 {
-    return width * height * sizeof(Pixel);
+    // the last redo state may still be compressed, the undo states being compressed are left alone
+    if (!redoStates.empty())
+    {
+        waitForCompression();
+        redoStates.clear();
+    }
+}
+
+SavedBitmapState Bitmap::swapWithState(SavedBitmapState &state)
+{
+    SavedBitmapState replaced(width, height, format, maxValue);
+    bool sameLayout = state.width == width && state.height == height && state.format == format;
+
+    // the tiles about to be overwritten are saved for the way back, all of them if the layout changes
+    std::vector<size_t> indices;
+    if (sameLayout)
+    {
+        for (const auto &tile : state.tiles)
+            indices.push_back(tile.first);
+    }
+    else
+    {
+        for (size_t index = 0; index < getTileCount(width, height); index++)
+            indices.push_back(index);
+    }
+
+    std::vector<std::vector<uint8_t> *> replacedTiles;
+    for (size_t index : indices)
+        replacedTiles.push_back(&replaced.tiles[index]);
+
+    WorkerPool::getInstance().forEachRowBand(indices.size(), [&](int first, int last) {
+        for (int i = first; i < last; i++)
+            copyTileFrom(data, getTileSpan(width, height, format, indices[i]), *replacedTiles[i]);
+    });
+
+    for (std::vector<uint8_t> *tile : replacedTiles)
+        replaced.savedBytes += tile->size();
+
+    restoreState(state);
+    return replaced;
+}
+
+void Bitmap::restoreState(const SavedBitmapState &state)
+{
+    if (state.width != width || state.height != height || state.format != format)
+    {
+        // every tile was saved before the layout changed, so the old image is rebuilt from the tiles alone
+        checkMemoryBudget(state.width, state.height, state.format);
+        freeMemory();
+        width = state.width;
+        height = state.height;
+        format = state.format;
+        allocateBitmapMemory(width, height);
+    }
+
+    // the maxvalue scales every 16-bit pixel into 8 bits
+    if (state.maxValue != maxValue)
+        pyramid.invalidate();
+    maxValue = state.maxValue;
+
+    std::vector<const std::pair<const size_t, std::vector<uint8_t>> *> tiles;
+    int tileColumns = getTileCount(width);
+
+    for (const auto &tile : state.tiles)
+    {
+        tiles.push_back(&tile);
+        pyramid.invalidate((int)(tile.first % tileColumns) * UNDO_TILE_SIZE, (int)(tile.first / tileColumns) * UNDO_TILE_SIZE, UNDO_TILE_SIZE, UNDO_TILE_SIZE);
+    }
+
+    int pixelBytes = PixelFormats::getRowSize(1, format);
+
+    WorkerPool::getInstance().forEachRowBand(tiles.size(), [&](int first, int last) {
+        std::vector<uint8_t> decoded;
+
+        for (int i = first; i < last; i++)
+        {
+            TileSpan span = getTileSpan(width, height, format, tiles[i]->first);
+
+            if (state.compressed)
+            {
+                decoded.resize(span.rowBytes * span.rowCount);
+                TileCodec::decode(tiles[i]->second, decoded.data(), decoded.size(), span.rowBytes, pixelBytes);
+                copyTileInto(data, span, decoded);
+            }
+            else
+            {
+                copyTileInto(data, span, tiles[i]->second);
+            }
+        }
+    });
+}
+
+bool Bitmap::canReplay()
+{
+    // the steps from the checkpoint up to the last one are replayed to undo it
+    size_t last = undoStates.size() - 1;
+
+    for (size_t index = last; index-- > 0 && last - index <= MAX_REPLAYED_OPERATIONS;)
+    {
+        const SavedBitmapState &state = undoStates[index];
+
+        if (!state.hasOperation)
+            return false;
+        if (state.method == UNDO_RESTORE_TILES)
+            return true;
+    }
+
+    return false;
+}
+
+size_t Bitmap::findCheckpoint(size_t index)
+{
+    // dropOldestStates never leaves a replayed step without its checkpoint
+    while (undoStates[index].method != UNDO_RESTORE_TILES)
+        index--;
+
+    return index;
+}
+
+void Bitmap::compressInBackground(SavedBitmapState &state)
+{
+    if (state.compressed)
+        return;
+
+    // the state is final and only touched again after waitForCompression
+    auto compress = [&state]() {
+        int pixelBytes = PixelFormats::getRowSize(1, state.format);
+        size_t savedBytes = 0;
+
+        for (auto &tile : state.tiles)
+        {
+            TileSpan span = getTileSpan(state.width, state.height, state.format, tile.first);
+
+            tile.second = TileCodec::encode(tile.second.data(), tile.second.size(), span.rowBytes, pixelBytes);
+            savedBytes += tile.second.size();
+        }
+
+        state.savedBytes = savedBytes;
+        state.compressed = true;
+    };
+
+    // small steps (like setting a pixel) aren't worth a thread
+    if (state.savedBytes < COMPRESS_IN_BACKGROUND_MIN_BYTES)
+        compress();
+    else
+        compression = std::async(std::launch::async, compress);
+}
+
+void Bitmap::waitForCompression()
+{
+    if (compression.valid())
+        compression.get();
+}
+
+void Bitmap::decompressState(SavedBitmapState &state)
+{
+    int pixelBytes = PixelFormats::getRowSize(1, state.format);
+    size_t savedBytes = 0;
+
+    for (auto &tile : state.tiles)
+    {
+        TileSpan span = getTileSpan(state.width, state.height, state.format, tile.first);
+        std::vector<uint8_t> decoded(span.rowBytes * span.rowCount);
+
+        TileCodec::decode(tile.second, decoded.data(), decoded.size(), span.rowBytes, pixelBytes);
+        tile.second.swap(decoded);
+        savedBytes += tile.second.size();
+    }
+
+    state.savedBytes = savedBytes;
+    state.compressed = false;
+}
+
+void Bitmap::dropOldestStates()
+{
+    size_t usage = 0;
+    for (const SavedBitmapState &state : undoStates)
+        usage += state.savedBytes;
+    for (const SavedBitmapState &state : redoStates)
+        usage += state.savedBytes;
+
+    if (undoStates.empty())
+        return;
+
+    // the last step is kept whatever its size, with the checkpoint it is replayed from
+    size_t kept = undoStates.size() - 1;
+    if (undoStates.back().method == UNDO_REPLAY)
+        kept = findCheckpoint(kept);
+
+    // the older ones go oldest first, the journaled steps right after a dropped checkpoint with it
+    while (usage > undoMemoryLimit && kept > 0)
+    {
+        do
+        {
+            usage -= undoStates.front().savedBytes;
+            undoStates.pop_front();
+            kept--;
+        } while (kept > 0 && undoStates.front().method != UNDO_RESTORE_TILES);
+    }
+}
+
+size_t Bitmap::getMapMemoryUsage(int width, int height, PIXEL_FORMAT format)
+{
+    return PixelFormats::getRowSize(width, format) * height;
 }
 
 bool Bitmap::hasPoint(int x, int y)
@@ -158,20 +905,40 @@ void Bitmap::fillWithColor(Pixel defaultFill, bool skipCommit)
         return;
     if (!skipCommit)
         commitPreChange();
+    saveAllTiles();
 
-    for (int x = 0; x < width; x++)
+    if (!PixelFormats::canRepresent(defaultFill, format))
     {
-        for (int y = 0; y < height; y++)
-        {
-            map[x][y] = defaultFill;
-        }
+        // the old pixels are all overwritten, so there is nothing to convert
+        int oldWidth = width;
+        int oldHeight = height;
+
+        PIXEL_FORMAT colorFormat = PixelFormats::getColorFormat(format);
+        int oldMaxValue = maxValue;
+
+        checkMemoryBudget(width, height, colorFormat);
+        freeMemory();
+        width = oldWidth;
+        height = oldHeight;
+        format = colorFormat;
+        maxValue = oldMaxValue;
+        allocateBitmapMemory(width, height);
     }
+
+    // the first row is filled in the storage format, and copied into the others
+    std::vector<Pixel> fill(width, defaultFill);
+    size_t stride = getStride();
+
+    PixelFormats::fromPixels(fill.data(), data, format, width, maxValue);
+
+    for (int y = 1; y < height; y++)
+        std::memcpy(data + y * stride, data, stride);
 }
 
 void Bitmap::closeBitmap()
 {
     freeMemory();
-    freePreviousBitmapStateMemory();
+    clearUndoHistory();
 }
 
 void Bitmap::openFromStream(std::istream &stream, progressHandlerType progressHandler)
@@ -180,92 +947,128 @@ void Bitmap::openFromStream(std::istream &stream, progressHandlerType progressHa
     Parser::loadToBitmap(*this, stream, progressHandler);
 }
 
-void Bitmap::saveToStream(std::ostream &stream, FILETYPE filetype, progressHandlerType progressHandler)
+void Bitmap::openFromFile(const std::string &path, progressHandlerType progressHandler)
 {
-    Parser::saveBitmapTo(*this, stream, filetype, progressHandler);
+    clearUndoHistory();
+    Parser::loadFromFile(*this, path, progressHandler);
+}
+
+void Bitmap::saveToStream(std::ostream &stream, FILETYPE filetype, progressHandlerType progressHandler, int valuesPerLine)
+{
+    applyPendingOperations();
+    Parser::saveBitmapTo(*this, stream, filetype, progressHandler, valuesPerLine);
 }
 
 void Bitmap::transformImage(pixelTransformFunction transformFunction, progressHandlerType progressHandler)
 {
-    if (hasOpenBitmap())
-    {
-        commitPreChange();
+    transformImage<pixelTransformFunction>(transformFunction, progressHandler);
+}
 
-        if (progressHandler)
-            progressHandler(0);
+void Bitmap::transformImage(pixelTransformWithLevelFunction transformFunctionWithLevel, int level, progressHandlerType progressHandler)
+{
+    transformImage<pixelTransformWithLevelFunction>(transformFunctionWithLevel, level, progressHandler);
+}
 
-        int pixelNum = 0;
-        int pixelCount = width * height;
+void Bitmap::undoLastChange()
+{
+    if (canUndo())
+    {
+        waitForCompression();
 
-        for (int x = 0; x < width; x++)
+        SavedBitmapState &state = undoStates.back();
+
+        if (!state.hasOperation)
         {
-            for (int y = 0; y < height; y++, pixelNum++)
-            {
-                if (progressHandler && pixelNum % PROGRESS_BAR_UPDATE_TRESHOLD == 0)
-                    progressHandler((float)pixelNum / pixelCount * 100);
+            applyPendingOperations();
+            SavedBitmapState replaced = swapWithState(state);
+            undoStates.pop_back();
+            redoStates.push_back(std::move(replaced));
 
-                map[x][y] = transformFunction(map[x][y]);
-            }
+            compressInBackground(redoStates.back());
+            return;
         }
-        if (progressHandler)
-            progressHandler(100);
-    }
-}
 
-void Bitmap::transformImage(pixelTransformWithLevelFunction transformFunctionWithLevel, int level, progressHandlerType progressHandler)
-{
-    if (hasOpenBitmap())
-    {
-        commitPreChange();
+        // a journaled step is redone by applying its operation again, so the image it replaces isn't saved
+        SavedBitmapState redone;
+        redone.method = UNDO_REPLAY;
+        redone.hasOperation = true;
+        redone.operation = state.operation;
+        redone.level = state.level;
 
-        if (progressHandler)
-            progressHandler(0);
+        if (!pendingOperations.isEmpty())
+        {
+            // the last recorded operation wasn't applied yet, so it is just dropped
+            pendingOperations.removeLast();
+        }
+        else if (state.method == UNDO_INVERT)
+        {
+            TransformPipeline inverse;
+            inverse.add(state.operation, state.level);
+            applyPipeline(inverse, nullptr);
+        }
+        else if (state.method == UNDO_REPLAY)
+        {
+            size_t last = undoStates.size() - 1;
+            size_t checkpoint = findCheckpoint(last);
 
-        int pixelNum = 0;
-        int pixelCount = width * height;
+            // the steps since the checkpoint are replayed in a single pass
+            TransformPipeline replayed;
+            for (size_t index = checkpoint; index < last; index++)
+                replayed.add(undoStates[index].operation, undoStates[index].level);
 
-        for (int x = 0; x < width; x++)
+            restoreState(undoStates[checkpoint]);
+            applyPipeline(replayed, nullptr);
+        }
+        else
         {
-            for (int y = 0; y < height; y++, pixelNum++)
-            {
-                if (progressHandler && pixelNum % PROGRESS_BAR_UPDATE_TRESHOLD == 0)
-                    progressHandler((float)pixelNum / pixelCount * 100);
-
-                map[x][y] = transformFunctionWithLevel(map[x][y], level);
-            }
+            restoreState(state);
         }
 
-        if (progressHandler)
-            progressHandler(100);
+        undoStates.pop_back();
+        redoStates.push_back(std::move(redone));
     }
 }
 
-void Bitmap::undoLastChange()
+bool Bitmap::canUndo()
 {
-    if (canUndo())
+    return !undoStates.empty();
+}
+
+void Bitmap::redoLastChange()
+{
+    if (canRedo())
     {
-        SavedBitmapState prevState = previousBitmapState.value();
-        freeMemory();
-        map = prevState.map;
-        width = prevState.width;
-        height = prevState.height;
-        previousBitmapState.reset();
+        waitForCompression();
+
+        SavedBitmapState state = std::move(redoStates.back());
+        redoStates.pop_back();
+
+        if (state.hasOperation)
+        {
+            // the operation is journaled again like a new one, keeping the steps left to redo
+            std::deque<SavedBitmapState> remaining;
+            remaining.swap(redoStates);
+            transform(state.operation, state.level);
+            redoStates.swap(remaining);
+        }
+        else
+        {
+            applyPendingOperations();
+            SavedBitmapState replaced = swapWithState(state);
+            undoStates.push_back(std::move(replaced));
+        }
     }
 }
 
-bool Bitmap::canUndo()
+bool Bitmap::canRedo()
 {
-    return previousBitmapState.has_value();
+    return !redoStates.empty();
 }
 
-Bitmap::Bitmap() {}
+Bitmap::Bitmap() : undoMemoryLimit(DEFAULT_UNDO_MEMORY_LIMIT) {}
 
-Bitmap::Bitmap(int initialWidth, int initialHeight, Pixel defaultFill)
+Bitmap::Bitmap(int initialWidth, int initialHeight, Pixel defaultFill) : Bitmap()
 {
-    if (initialWidth * initialHeight > MAX_PIXELS || initialWidth > INT32_MAX / initialHeight)
-    {
-        throw std::invalid_argument("Exceeded max allowed pixel count");
-    }
     if (initialWidth > 0 && initialHeight > 0)
     {
         createBlank(initialWidth, initialHeight, defaultFill);
@@ -283,41 +1086,12 @@ Bitmap::~Bitmap()
 
 Bitmap* Bitmap::combineBitmaps(Bitmap *b1, Bitmap *b2, pixelCombinationFunction combinationFunction, progressHandlerType progressHandler)
 {
-    if (!(b1->hasOpenBitmap() && b2->hasOpenBitmap()))
-        throw no_bitmap_open_exception("Both bitmaps must have images open");
-
-    int width = b1->getWidth();
-    int height = b1->getHeight();
+    std::unique_ptr<Bitmap> result(new Bitmap());
 
-    if (b2->getWidth() != width || b2->getHeight() != height)
-        throw bitmap_size_mismatch("Both bitmaps must have equal dimensions");
-
-    Bitmap* result = new Bitmap(width, height);
-
-    Pixel p1;
-    Pixel p2;
-    
-    int totalPixels = width * height;
-    int pixelNumber = 0;
-
-    if (progressHandler)
-        progressHandler(0);
-
-    for (int x = 0; x < width; x++)
-    {
-        for (int y = 0; y < height; y++, pixelNumber++)
-        {
-            if (progressHandler && pixelNumber % PROGRESS_BAR_UPDATE_TRESHOLD == 0)
-                progressHandler((pixelNumber * 100) / totalPixels);
-            
-            p1 = b1->getPixelAtFast(x, y);
-            p2 = b2->getPixelAtFast(x, y);
-            result->setPixelAtFast(x, y, combinationFunction(p1, p2));
-        }
-    }
-
-    if (progressHandler)
-        progressHandler(100);
+    combineBitmaps(*b1, *b2, *result, [&combinationFunction](const Pixel *row1, const Pixel *row2, Pixel *destination, int width) {
+        for (int x = 0; x < width; x++)
+            destination[x] = combinationFunction(row1[x], row2[x]);
+    }, progressHandler);
 
-    return result;
-}
\ No newline at end of file
+    return result.release();
+}
@@ -1,8 +1,21 @@
 #pragma once
+#include <atomic>
+#include <deque>
 #include <functional>
+#include <future>
 #include <iostream>
-#include <optional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "exceptions.h"
+#include "imagepyramid.h"
 #include "pixel.h"
+#include "pixelformat.h"
+#include "transformations.h"
+#include "transformpipeline.h"
+#include "workerpool.h"
 
 typedef std::function<void(int)> progressHandlerType;
 
@@ -10,6 +23,10 @@ typedef std::function<Pixel(Pixel)> pixelTransformFunction;
 typedef std::function<Pixel(Pixel, int)> pixelTransformWithLevelFunction;
 typedef std::function<Pixel(Pixel, Pixel)> pixelCombinationFunction;
 
+typedef std::function<void(Pixel *, int)> rowTransformFunction;
+typedef std::function<void(Pixel *, int, int)> rowTransformWithLevelFunction;
+typedef std::function<void(const Pixel *, const Pixel *, Pixel *, int)> rowCombinationFunction;
+
 // Represents the Portable AnyMap variant (P-number)
 enum FILETYPE
 {
@@ -24,19 +41,49 @@ enum FILETYPE
     // Portable GrayMap, a grayscale (0~255) bitmap represented in binary (raw)
     P5,
     // Portable PixMap, an RGB (0~255 x 3) bitmap represented in binary (raw)
-    P6
+    P6,
+    // Portable Arbitrary Map, a grayscale or RGB bitmap with optional alpha, represented in binary (raw)
+    P7
+};
+
+class MappedFile;
+
+// How an undo step brings back the image before it
+enum UNDO_METHOD
+{
+    // copies the saved tiles back
+    UNDO_RESTORE_TILES,
+    // applies the operation of the step again, for operations being their own inverse
+    UNDO_INVERT,
+    // restores the checkpoint before the step, and replays the operations since then
+    UNDO_REPLAY
 };
 
 // Represents the bitmap and dimensions at some point in the past, to undo the changes into old state.
+// The bitmap is divided into square tiles, and only the tiles changed since then are kept, copied right before their first change.
 struct SavedBitmapState {
-    Pixel** map = nullptr;
     int width = 0;
     int height = 0;
+    PIXEL_FORMAT format = FORMAT_RGB;
+    int maxValue = 255;
+    // Old contents of the changed tiles by tile index (row-major), their rows stored back to back.
+    // The other tiles of the bitmap still hold the saved state.
+    std::unordered_map<size_t, std::vector<uint8_t>> tiles;
+    // Sum of the tile sizes
+    size_t savedBytes = 0;
+    // Set once the tiles are encoded with TileCodec
+    bool compressed = false;
+    UNDO_METHOD method = UNDO_RESTORE_TILES;
+    // Set for the steps done by Bitmap::transform, which are journaled as their operation and level.
+    // A journaled step restoring tiles has all of them saved, so it is a checkpoint the steps after it can be replayed from.
+    bool hasOperation = false;
+    TRANSFORM_OPERATION operation = OP_NEGATIVE;
+    int level = 0;
 
-    SavedBitmapState(Pixel **_map, int _width, int _height)
-        : map(_map), width(_width), height(_height) {};
+    SavedBitmapState(int _width, int _height, PIXEL_FORMAT _format, int _maxValue)
+        : width(_width), height(_height), format(_format), maxValue(_maxValue) {};
 
-    SavedBitmapState() : SavedBitmapState(nullptr, 0, 0) {};
+    SavedBitmapState() : SavedBitmapState(0, 0, FORMAT_RGB, 255) {};
 };
 
 // Represents a 2D bitmap, saves and loads the bitmap, handles image transformations.
@@ -52,28 +99,86 @@ class Bitmap {
         // Returns the number of bytes occupied by the loaded bitmap.
         size_t getBitmapMemUsage();
         
-        // Returns the number of bytes occupied by the undo stack history, if exists.
+        // Returns the number of bytes occupied by the undo and redo history, as stored (compressed).
         size_t getUndoStackMemUsage();
 
+        // Sets the number of bytes the undo and redo history may take, the oldest steps are dropped past it.
+        // The last step can always be undone, whatever its size. 0 turns the history off, for batch jobs.
+        // Changes saving the whole image of an out of core bitmap larger than the limit end the history instead, as the copy
+        // would be held in memory. Its negatives and edits of regions stay undoable.
+        void setUndoMemoryLimit(size_t bytes);
+        size_t getUndoMemoryLimit();
+
         // Returns the number of bytes occupied by both the bitmap and undo stack history.
         size_t getTotalMemUsage();
 
+        // Sets the largest number of bytes the pixels of one bitmap may take in memory, checked before allocating them.
+        // Defaults to the physical memory size. Pixels used straight from a mapped file don't count until copied.
+        static void setMemoryBudget(size_t bytes);
+        static size_t getMemoryBudget();
+
+        // Sets the directory of the scratch files holding the bitmaps over the memory budget. Their pixels are paged in
+        // by the OS as they are accessed, the least recently used ones written back, so only the rows in use take memory.
+        // Defaults to the system temporary directory, an empty path refuses these bitmaps instead.
+        static void setScratchDirectory(const std::string &directory);
+        static std::string getScratchDirectory();
+
+        // Throws too_large_exception if the pixels of given dimensions and format would exceed the memory budget
+        // and can't go to a scratch file, or don't fit the address space at all.
+        static void checkMemoryBudget(int width, int height, PIXEL_FORMAT format);
+
+        // Returns if the pixels are stored in a scratch file, for being over the memory budget.
+        bool isOutOfCore();
+
         // Returns if any bitmap is open (allocated).
         bool hasOpenBitmap();
 
+        // Returns how the pixels are stored. Grayscale and black and white images keep a narrower format until
+        // an operation produces colors it can't hold, then they are widened to RGB.
+        PIXEL_FORMAT getPixelFormat();
+
+        // Returns the largest channel value. 255 for 8-bit formats, up to 65535 for 16-bit ones.
+        int getMaxValue();
+
+        // Converts the storage to given format. Narrowing drops colors, like saving as PGM or PBM does.
+        void convertToFormat(PIXEL_FORMAT newFormat);
+
         // Returns the pixel at given coordinantes.
         Pixel getPixelAt(int x, int y);
 
         // Returns the pixel at given coordinantes, used for internal purposes. Skips a lot of checks.
         Pixel getPixelAtFast(int x, int y);
 
+        // Sets the pixel at given coordinantes, widening the storage to RGB if the pixel doesn't fit the current format.
         bool setPixelAt(int x, int y, Pixel newPixel, bool skipCommit = false);
 
-        // Quick pixel set, used for internal purposes. Skips a lot of checks.
+        // Quick pixel set, used for internal purposes. Skips a lot of checks, the pixel must fit the storage format.
         void setPixelAtFast(int x, int y, Pixel newPixel);
 
-        // Updates the bitmap dimensions and clears the bitmap, with possibility to select a fill color. Overrides existing bitmap and clears the undo history.
-        void createBlank(int width, int height, Pixel defaultFill = Pixel());
+        // Returns the pointer to the first pixel of given row. Rows are stored contiguously, top to bottom.
+        // Only for RGB storage, use getRowData or readRows for the other formats.
+        // Writes through row pointers are not seen by the undo history, use the Bitmap functions to edit the image.
+        Pixel* getRow(int y);
+
+        // Returns the pointer to the first byte of given row, stored in the bitmap pixel format.
+        uint8_t* getRowData(int y);
+
+        // Returns the halvings of the image for showing it zoomed out, computed on the first call. Later calls only
+        // recompute them over the regions changed since. Like the undo history, writes through row pointers and
+        // setPixelAtFast are not seen.
+        // Must not be called from a progress handler: the bitmap is halfway through a change, which would be left out
+        // of the pyramid. Throws std::logic_error when called during a pass of the worker pool or a transformation.
+        const ImagePyramid &getPyramid();
+
+        // Copies rowCount rows starting at firstRow into destination as RGB pixels, whatever the storage format.
+        void readRows(int firstRow, int rowCount, Pixel *destination);
+
+        // Returns the number of bytes between the starts of two consecutive rows.
+        size_t getStride();
+
+        // Updates the bitmap dimensions and clears the bitmap, with possibility to select a fill color and storage format. Overrides existing bitmap and clears the undo history.
+        // maxValue only applies to 16-bit formats, 0 meaning the whole 16-bit range.
+        void createBlank(int width, int height, Pixel defaultFill = Pixel(), PIXEL_FORMAT format = FORMAT_RGB, int maxValue = 0);
 
         // Clears the bitmap, with possibility to select a fill color.
         void fillWithColor(Pixel defaultFill = Pixel(), bool skipCommit = false);
@@ -84,21 +189,69 @@ class Bitmap {
         // Reads the bitmap file from stream and overrides the current image.
         void openFromStream(std::istream &stream, progressHandlerType progressHandler = nullptr);
 
+        // Reads the bitmap file from disk and overrides the current image. The file is memory-mapped while it is read, raw rows are copied in parallel.
+        void openFromFile(const std::string &path, progressHandlerType progressHandler = nullptr);
+
         // Saves the PPM bitmap to a stream, based on given filetype (P-number).
-        void saveToStream(std::ostream &stream, FILETYPE filetype = P3, progressHandlerType progressHandler = nullptr);
+        // ASCII filetypes put valuesPerLine values on each line, capped to stay within 70 characters. 0 keeps the default of the filetype.
+        void saveToStream(std::ostream &stream, FILETYPE filetype = P3, progressHandlerType progressHandler = nullptr, int valuesPerLine = 0);
+
+        // Applies a built-in transformation, in the storage format of the image. 16-bit images keep their depth,
+        // 8-bit ones use the RowTransformations kernels. Level is ignored by operations without one.
+        // The step is journaled for undo as the operation and level, so it saves no tiles unless it becomes a checkpoint.
+        // The operation is only recorded, the ones recorded in a row run in a single pass once the pixels are needed
+        // (getPixelAt, setPixelAt, getRow, readRows, saving, combining, evaluating, getPyramid). The progress handler only
+        // reports the earlier operations when the step becomes a checkpoint and runs them, it isn't kept past the call.
+        void transform(TRANSFORM_OPERATION operation, int level = 0, progressHandlerType progressHandler = nullptr);
+
+        // Applies the operations recorded by transform right away, in one pass reported to the progress handler.
+        // getPixelAtFast, setPixelAtFast, getRowData and getStride leave them recorded, call it before using those.
+        void applyPendingOperations(progressHandlerType progressHandler = nullptr);
+
+        // Stores the result of an expression of BitmapExpressions into the bitmap, computed in a single pass.
+        // The result is 8-bit RGB, the alpha of the bitmap is kept. The bitmap may be one of the operands, if its dimensions
+        // differ it is created blank first, which clears the undo history.
+        template <typename Expression>
+        void evaluate(Expression expression, progressHandlerType progressHandler = nullptr);
 
         // Transforms the image based on given transformation function.
+        // All transform functions run on the shared WorkerPool, so they may be called from several threads at once.
+        // Pixel functions work on 8-bit channels, so 16-bit images are reduced to 8 bits first.
         void transformImage(pixelTransformFunction, progressHandlerType progressHandler = nullptr);
 
         // Transforms the image based on given transformation function and strength/level of the transformation.
         void transformImage(pixelTransformWithLevelFunction, int, progressHandlerType progressHandler = nullptr);
 
+        // Transforms the image based on given function or functor, called as transformFunction(pixel). The call can be inlined into the loop.
+        template <typename F>
+        void transformImage(F transformFunction, progressHandlerType progressHandler = nullptr);
+
+        // Transforms the image based on given function or functor, called as transformFunction(pixel, level). The call can be inlined into the loop.
+        template <typename F>
+        void transformImage(F transformFunctionWithLevel, int level, progressHandlerType progressHandler = nullptr);
+
+        // Transforms the image a whole row at a time, kernel is called as kernel(row, width).
+        // The kernel must transform every pixel on its own, so grayscale images can be transformed through a table of gray levels.
+        // 16-bit images are reduced to 8 bits first, use transform to keep their depth. Alpha is left untouched.
+        template <typename RowKernel>
+        void transformRows(RowKernel kernel, progressHandlerType progressHandler = nullptr);
+
+        // Transforms the image a whole row at a time, kernel is called as kernel(row, width, level).
+        template <typename RowKernel>
+        void transformRows(RowKernel kernel, int level, progressHandlerType progressHandler = nullptr);
+
         // Undo the last change, and load previous bitmap state, if exists. Related: canUndo()
         void undoLastChange();
 
         // Returns if undo operation is available.
         bool canUndo();
 
+        // Applies the last undone change again, if no other change happened since. Related: canRedo()
+        void redoLastChange();
+
+        // Returns if redo operation is available.
+        bool canRedo();
+
         // Creates an empty bitmap.
         Bitmap();
 
@@ -111,17 +264,315 @@ class Bitmap {
         ~Bitmap();
 
         // Combines two bitmaps according to the combination function, and returns the result. Both must have equal dimensions.
+        // The function works on 8-bit pixels, so the result is 8-bit, without alpha.
+        // BitmapExpressions combines into an existing bitmap instead, along with transformations, in a single pass.
         static Bitmap* combineBitmaps(Bitmap* b1, Bitmap* b2, pixelCombinationFunction combinationFunction, progressHandlerType progressHandler = nullptr);
+
+        // Combines two bitmaps of equal dimensions into destination, which may be either of them, a band of rows per worker.
+        // The kernel is called as kernel(row1, row2, destinationRow, width) like RowCombinations, from several threads at once.
+        // RGB rows are combined where they are stored, the others go through rows of 8-bit pixels. The destination is created
+        // blank if its dimensions differ, otherwise the change goes to its undo history, and its alpha is kept.
+        template <typename RowKernel>
+        static void combineBitmaps(Bitmap &b1, Bitmap &b2, Bitmap &destination, RowKernel kernel, progressHandlerType progressHandler = nullptr);
     private:
+        friend class Parser;
+
         void freeMemory();
-        void freePreviousBitmapStateMemory();
         void allocateBitmapMemory(int width, int height);
+        // Starts a new undo state, after applying the pending operations. Tiles are only copied into it by saveRegion or saveAllTiles, right before they change.
         void commitPreChange();
+        // Starts a new undo state as is, for transform to record an operation.
+        void pushUndoState();
+        // Saves the tiles covering given pixels into the undo state, unless already saved.
+        void saveRegion(int x, int y, int regionWidth, int regionHeight);
+        // Saves every tile not saved yet, before a change of the whole image.
+        void saveAllTiles();
+        // Returns the undo state collecting the tiles of the change in progress, null if they aren't saved.
+        SavedBitmapState *getChangeState();
         void clearUndoHistory();
-        size_t getMapMemoryUsage(int width, int height);
-        std::optional<SavedBitmapState> previousBitmapState { };
+        void clearRedoStates();
+        // Restores given state into the bitmap, and returns the state it replaced
+        SavedBitmapState swapWithState(SavedBitmapState &state);
+        // Copies the tiles of given state into the bitmap, leaving the state as it is
+        void restoreState(const SavedBitmapState &state);
+        // Returns if the last undo state can be undone by replaying the steps since the checkpoint before it, few enough of them
+        bool canReplay();
+        // Returns the index of the checkpoint the undo state at given index is replayed from
+        size_t findCheckpoint(size_t index);
+        // Applies journaled operations in one pass over the image. The changes aren't saved as tiles.
+        void applyPipeline(TransformPipeline &pipeline, progressHandlerType progressHandler);
+        // Returns the format of a combination of two bitmaps. Gray ones give a gray result if the kernel keeps every pair of their gray levels gray.
+        template <typename RowKernel>
+        static PIXEL_FORMAT getCombinationFormat(Bitmap &b1, Bitmap &b2, RowKernel &kernel);
+        // Transforms the rows like transformRows, without saving anything for undo
+        template <typename RowKernel>
+        void applyRows(RowKernel kernel, progressHandlerType progressHandler);
+        // Encodes the tiles of a state on a background thread. Only one state is compressed at a time.
+        void compressInBackground(SavedBitmapState &state);
+        // Waits for the background compression, before touching any state but the last one
+        void waitForCompression();
+        static void decompressState(SavedBitmapState &state);
+        // Drops the oldest undo steps past the memory limit
+        void dropOldestStates();
+        size_t getMapMemoryUsage(int width, int height, PIXEL_FORMAT format);
+        static uint8_t* allocateData(size_t size);
+        // Allocates the pixels of given layout, in a scratch file set into file if they are over the memory budget
+        static uint8_t* allocatePixels(int width, int height, PIXEL_FORMAT format, std::shared_ptr<MappedFile> &file);
+        static void freeData(uint8_t* data);
+        // Creates the bitmap from rows stored exactly like the rows of given pixel format, copying them in parallel.
+        // The raw rows of a mapped file are copied out, so the bitmap never reads from a file that may change under it.
+        void copyPixels(const char *pixels, int width, int height, PIXEL_FORMAT format, progressHandlerType progressHandler);
+        // Converts the storage without touching the undo history
+        void changeFormat(PIXEL_FORMAT newFormat);
+        // Applies the result of a transformation on every gray level to a gray (with or without alpha) or bilevel image.
+        // Returns false if the result isn't gray.
+        bool applyGrayLevels(const Pixel *levels, progressHandlerType progressHandler);
+        // Undo steps, oldest first. The last one collects the tiles of the change in progress.
+        std::deque<SavedBitmapState> undoStates;
+        // Undone steps, the last undone one last
+        std::deque<SavedBitmapState> redoStates;
+        std::future<void> compression;
+        size_t undoMemoryLimit;
+        static std::atomic<size_t> memoryBudget;
+        static std::string scratchDirectory;
+        static std::mutex scratchDirectoryMutex;
+        // Set while journaled operations change the image
+        bool applyingOperation = false;
+        // Operations recorded by transform and not applied yet, each one the step of an undo state at the top of the history
+        TransformPipeline pendingOperations;
         int width = 0;
         int height = 0;
         bool hasPoint(int x, int y);
-        Pixel** map = nullptr;
-};
\ No newline at end of file
+        // Row-major pixel buffer, rows of getStride() bytes stored in the pixel format.
+        uint8_t* data = nullptr;
+        PIXEL_FORMAT format = FORMAT_RGB;
+        int maxValue = 255;
+        // Set when data points into a scratch file mapping instead of an own allocation.
+        std::shared_ptr<MappedFile> mappedFile;
+        // Marked by the same calls saving the undo tiles, before each change
+        ImagePyramid pyramid;
+};
+
+template <typename F>
+void Bitmap::transformImage(F transformFunction, progressHandlerType progressHandler)
+{
+    transformRows([&transformFunction](Pixel *row, int width) {
+        for (int x = 0; x < width; x++)
+            row[x] = transformFunction(row[x]);
+    }, progressHandler);
+}
+
+template <typename F>
+void Bitmap::transformImage(F transformFunctionWithLevel, int level, progressHandlerType progressHandler)
+{
+    transformRows([&transformFunctionWithLevel](Pixel *row, int width, int level) {
+        for (int x = 0; x < width; x++)
+            row[x] = transformFunctionWithLevel(row[x], level);
+    }, level, progressHandler);
+}
+
+template <typename Expression>
+void Bitmap::evaluate(Expression expression, progressHandlerType progressHandler)
+{
+    expression.prepare();
+
+    int resultWidth = expression.getWidth();
+    int resultHeight = expression.getHeight();
+
+    if (!hasOpenBitmap() || width != resultWidth || height != resultHeight)
+    {
+        createBlank(resultWidth, resultHeight);
+    }
+    else
+    {
+        commitPreChange();
+        saveAllTiles();
+        changeFormat(PixelFormats::hasAlpha(format) ? FORMAT_RGB_ALPHA : FORMAT_RGB);
+    }
+
+    if (progressHandler)
+        progressHandler(0);
+
+    // every row of the result only depends on the same row of the operands, so it can overwrite one of them
+    WorkerPool::getInstance().forEachRowBand(height, [this, &expression](int firstRow, int lastRow) {
+        std::vector<Pixel> row(width);
+        std::vector<Pixel> scratch((size_t)Expression::scratchRows * width);
+
+        for (int y = firstRow; y < lastRow; y++)
+        {
+            expression.evaluate(y, row.data(), width, scratch.data());
+            PixelFormats::setColors(row.data(), getRowData(y), format, width);
+        }
+    }, progressHandler);
+
+    if (progressHandler)
+        progressHandler(100);
+}
+
+template <typename RowKernel>
+void Bitmap::combineBitmaps(Bitmap &b1, Bitmap &b2, Bitmap &destination, RowKernel kernel, progressHandlerType progressHandler)
+{
+    if (!(b1.hasOpenBitmap() && b2.hasOpenBitmap()))
+        throw no_bitmap_open_exception("Both bitmaps must have images open");
+    if (b1.width != b2.width || b1.height != b2.height)
+        throw bitmap_size_mismatch("Both bitmaps must have equal dimensions");
+
+    // the rows are read from several threads
+    b1.applyPendingOperations();
+    b2.applyPendingOperations();
+
+    PIXEL_FORMAT resultFormat = getCombinationFormat(b1, b2, kernel);
+
+    if (!destination.hasOpenBitmap() || destination.width != b1.width || destination.height != b1.height)
+    {
+        destination.createBlank(b1.width, b1.height, Pixel(), resultFormat);
+    }
+    else
+    {
+        destination.commitPreChange();
+        destination.saveAllTiles();
+
+        if (PixelFormats::hasAlpha(destination.format))
+            resultFormat = PixelFormats::isGray(resultFormat) ? FORMAT_GRAY_ALPHA : FORMAT_RGB_ALPHA;
+        destination.changeFormat(resultFormat);
+    }
+
+    if (progressHandler)
+        progressHandler(0);
+
+    int width = b1.width;
+
+    if (b1.format == FORMAT_RGB && b2.format == FORMAT_RGB && destination.format == FORMAT_RGB)
+    {
+        WorkerPool::getInstance().forEachRowBand(b1.height, [&](int firstRow, int lastRow) {
+            for (int y = firstRow; y < lastRow; y++)
+                kernel(b1.getRow(y), b2.getRow(y), destination.getRow(y), width);
+        }, progressHandler);
+    }
+    else
+    {
+        WorkerPool::getInstance().forEachRowBand(b1.height, [&](int firstRow, int lastRow) {
+            std::vector<Pixel> rows(3 * (size_t)width);
+            Pixel *row1 = rows.data();
+            Pixel *row2 = row1 + width;
+            Pixel *combined = row2 + width;
+
+            for (int y = firstRow; y < lastRow; y++)
+            {
+                PixelFormats::toPixels(b1.getRowData(y), b1.format, row1, width, b1.maxValue);
+                PixelFormats::toPixels(b2.getRowData(y), b2.format, row2, width, b2.maxValue);
+                kernel(row1, row2, combined, width);
+                PixelFormats::setColors(combined, destination.getRowData(y), destination.format, width);
+            }
+        }, progressHandler);
+    }
+
+    if (progressHandler)
+        progressHandler(100);
+}
+
+template <typename RowKernel>
+PIXEL_FORMAT Bitmap::getCombinationFormat(Bitmap &b1, Bitmap &b2, RowKernel &kernel)
+{
+    if (PixelFormats::getChannelCount(b1.format) != 1 || PixelFormats::getChannelCount(b2.format) != 1)
+        return FORMAT_RGB;
+
+    PIXEL_FORMAT resultFormat = b1.format == FORMAT_BILEVEL && b2.format == FORMAT_BILEVEL ? FORMAT_BILEVEL : FORMAT_GRAY;
+
+    // every gray level of the second bitmap is combined with each level of the first at once
+    int levelStep1 = b1.format == FORMAT_BILEVEL ? 255 : 1;
+    int levelStep2 = b2.format == FORMAT_BILEVEL ? 255 : 1;
+
+    Pixel levels1[256];
+    Pixel levels2[256];
+    Pixel combined[256];
+    int levelCount = 0;
+
+    for (int value2 = 0; value2 < 256; value2 += levelStep2)
+        levels2[levelCount++] = Pixel(value2, value2, value2);
+
+    for (int value1 = 0; value1 < 256 && resultFormat != FORMAT_RGB; value1 += levelStep1)
+    {
+        std::fill(levels1, levels1 + levelCount, Pixel(value1, value1, value1));
+        kernel(levels1, levels2, combined, levelCount);
+
+        for (int i = 0; i < levelCount && resultFormat != FORMAT_RGB; i++)
+        {
+            if (!PixelFormats::canRepresent(combined[i], resultFormat))
+                resultFormat = PixelFormats::canRepresent(combined[i], FORMAT_GRAY) ? FORMAT_GRAY : FORMAT_RGB;
+        }
+    }
+
+    return resultFormat;
+}
+
+template <typename RowKernel>
+void Bitmap::transformRows(RowKernel kernel, progressHandlerType progressHandler)
+{
+    if (hasOpenBitmap())
+    {
+        commitPreChange();
+        saveAllTiles();
+        applyRows(kernel, progressHandler);
+    }
+}
+
+template <typename RowKernel>
+void Bitmap::applyRows(RowKernel kernel, progressHandlerType progressHandler)
+{
+    if (progressHandler)
+        progressHandler(0);
+
+    bool transformed = false;
+
+    if (PixelFormats::isDeep(format))
+        changeFormat(PixelFormats::getShallowFormat(format));
+
+    if (PixelFormats::isGray(format))
+    {
+        // pixels are transformed on their own, so transforming every gray level gives the whole transformation of a gray image
+        Pixel levels[256];
+        for (int value = 0; value < 256; value++)
+            levels[value] = Pixel(value, value, value);
+
+        kernel(levels, 256);
+        transformed = applyGrayLevels(levels, progressHandler);
+    }
+
+    if (!transformed && !PixelFormats::hasAlpha(format))
+    {
+        changeFormat(FORMAT_RGB);
+
+        WorkerPool::getInstance().forEachRowBand(height, [this, &kernel](int firstRow, int lastRow) {
+            for (int y = firstRow; y < lastRow; y++)
+                kernel(getRow(y), width);
+        }, progressHandler);
+    }
+    else if (!transformed)
+    {
+        // the kernel works on pixels, so the colors go through a row of them and the alpha stays in place
+        changeFormat(FORMAT_RGB_ALPHA);
+
+        WorkerPool::getInstance().forEachRowBand(height, [this, &kernel](int firstRow, int lastRow) {
+            std::vector<Pixel> pixels(width);
+
+            for (int y = firstRow; y < lastRow; y++)
+            {
+                PixelFormats::toPixels(getRowData(y), format, pixels.data(), width);
+                kernel(pixels.data(), width);
+                PixelFormats::setColors(pixels.data(), getRowData(y), format, width);
+            }
+        }, progressHandler);
+    }
+
+    if (progressHandler)
+        progressHandler(100);
+}
+
+template <typename RowKernel>
+void Bitmap::transformRows(RowKernel kernel, int level, progressHandlerType progressHandler)
+{
+    transformRows([&kernel, level](Pixel *row, int width) {
+        kernel(row, width, level);
+    }, progressHandler);
+}
@@ -0,0 +1,154 @@
+#pragma once
+#include "bitmap.h"
+#include "exceptions.h"
+#include "transformations.h"
+#include "transformpipeline.h"
+#include <algorithm>
+
+// Expressions combining and transforming bitmaps, like negative(multiply(a, b)) or add(a, brightness(b, 20)),
+// evaluated by Bitmap::evaluate in a single pass. Each row of the result is computed from the same row of every bitmap,
+// with the row kernels of RowCombinations and RowTransformations, while the rows are still in cache.
+// The expressions only keep pointers to the bitmaps, which must stay open until the evaluation.
+namespace BitmapExpressions {
+    typedef void (*rowCombinationKernel)(const Pixel *, const Pixel *, Pixel *, int);
+
+    // Every node provides getWidth and getHeight, prepare (called once before evaluating, from one thread)
+    // and evaluate(y, row, width, scratch), which stores row y of the node into row, using scratchRows rows of scratch.
+
+    // A bitmap, read as 8-bit RGB pixels whatever its format
+    class Source {
+        public:
+            static constexpr int scratchRows = 0;
+
+            explicit Source(Bitmap &bitmap) : bitmap(&bitmap) {}
+
+            int getWidth() const { return bitmap->getWidth(); }
+            int getHeight() const { return bitmap->getHeight(); }
+
+            void prepare()
+            {
+                if (!bitmap->hasOpenBitmap())
+                    throw no_bitmap_open_exception("All bitmaps of an expression must have images open");
+
+                // rows are read from several threads, so nothing may be left pending
+                bitmap->applyPendingOperations();
+            }
+
+            void evaluate(int y, Pixel *row, int width, Pixel *scratch) const
+            {
+                bitmap->readRows(y, 1, row);
+            }
+        private:
+            Bitmap *bitmap;
+    };
+
+    // Built-in transformations of an operand, fused into one pipeline when nested
+    template <typename Operand>
+    class Transform {
+        public:
+            static constexpr int scratchRows = Operand::scratchRows;
+
+            Transform(const Operand &operand, TransformPipeline pipeline) : operand(operand), pipeline(pipeline) {}
+
+            int getWidth() const { return operand.getWidth(); }
+            int getHeight() const { return operand.getHeight(); }
+
+            void prepare()
+            {
+                operand.prepare();
+                pipeline.compile();
+            }
+
+            void evaluate(int y, Pixel *row, int width, Pixel *scratch) const
+            {
+                operand.evaluate(y, row, width, scratch);
+                pipeline.applyToRow(row, width);
+            }
+
+            // Returns the node with given transformation appended to the pipeline
+            Transform then(TRANSFORM_OPERATION operation, int level) const
+            {
+                TransformPipeline longer = pipeline;
+                longer.add(operation, level);
+                return Transform(operand, longer);
+            }
+        private:
+            Operand operand;
+            TransformPipeline pipeline;
+    };
+
+    // Two operands combined by a row kernel. The right one is computed into the first scratch row.
+    template <typename Left, typename Right, rowCombinationKernel Kernel>
+    class Combination {
+        public:
+            static constexpr int scratchRows = 1 + std::max(Left::scratchRows, Right::scratchRows);
+
+            Combination(const Left &left, const Right &right) : left(left), right(right) {}
+
+            int getWidth() const { return left.getWidth(); }
+            int getHeight() const { return left.getHeight(); }
+
+            void prepare()
+            {
+                left.prepare();
+                right.prepare();
+
+                if (left.getWidth() != right.getWidth() || left.getHeight() != right.getHeight())
+                    throw bitmap_size_mismatch("All bitmaps of an expression must have equal dimensions");
+            }
+
+            void evaluate(int y, Pixel *row, int width, Pixel *scratch) const
+            {
+                right.evaluate(y, scratch, width, scratch + width);
+                left.evaluate(y, row, width, scratch + width);
+                Kernel(row, scratch, row, width);
+            }
+        private:
+            Left left;
+            Right right;
+    };
+
+    // Turns the arguments of the functions below into nodes, bitmaps becoming sources
+    inline Source toNode(Bitmap &bitmap) { return Source(bitmap); }
+
+    template <typename Node>
+    Node toNode(const Node &node) { return node; }
+
+    template <typename Node>
+    Transform<Node> appendTransform(const Node &node, TRANSFORM_OPERATION operation, int level)
+    {
+        TransformPipeline pipeline;
+        pipeline.add(operation, level);
+        return Transform<Node>(node, pipeline);
+    }
+
+    template <typename Node>
+    Transform<Node> appendTransform(const Transform<Node> &node, TRANSFORM_OPERATION operation, int level)
+    {
+        return node.then(operation, level);
+    }
+
+    template <typename A, typename B>
+    auto add(A &&a, B &&b) { return Combination<decltype(toNode(a)), decltype(toNode(b)), RowCombinations::add>(toNode(a), toNode(b)); }
+
+    template <typename A, typename B>
+    auto substract(A &&a, B &&b) { return Combination<decltype(toNode(a)), decltype(toNode(b)), RowCombinations::substract>(toNode(a), toNode(b)); }
+
+    template <typename A, typename B>
+    auto multiply(A &&a, B &&b) { return Combination<decltype(toNode(a)), decltype(toNode(b)), RowCombinations::multiply>(toNode(a), toNode(b)); }
+
+    template <typename A>
+    auto brightness(A &&a, int level) { return appendTransform(toNode(a), OP_BRIGHTNESS, level); }
+
+    template <typename A>
+    auto saturation(A &&a, int level) { return appendTransform(toNode(a), OP_SATURATION, level); }
+
+    template <typename A>
+    auto grayscale(A &&a) { return appendTransform(toNode(a), OP_GRAYSCALE, 0); }
+
+    template <typename A>
+    auto negative(A &&a) { return appendTransform(toNode(a), OP_NEGATIVE, 0); }
+
+    template <typename A>
+    auto blacknwhite(A &&a) { return appendTransform(toNode(a), OP_BLACKNWHITE, 0); }
+}
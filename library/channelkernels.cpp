@@ -0,0 +1,36 @@
+#include "channelkernels.h"
+
+namespace ChannelKernels {
+    namespace {
+        bool isLittleEndian()
+        {
+            const uint16_t probe = 1;
+            return *reinterpret_cast<const uint8_t *>(&probe) == 1;
+        }
+    }
+
+    // both loops are simple enough for the compiler to vectorize into byte shuffles
+
+    void fromBigEndian(uint16_t *values, size_t count, unsigned maxValue)
+    {
+        if (isLittleEndian())
+        {
+            for (size_t i = 0; i < count; i++)
+                values[i] = std::min<unsigned>((uint16_t)(values[i] << 8 | values[i] >> 8), maxValue);
+        }
+        else
+        {
+            for (size_t i = 0; i < count; i++)
+                values[i] = std::min<unsigned>(values[i], maxValue);
+        }
+    }
+
+    void toBigEndian(uint16_t *values, size_t count)
+    {
+        if (isLittleEndian())
+        {
+            for (size_t i = 0; i < count; i++)
+                values[i] = values[i] << 8 | values[i] >> 8;
+        }
+    }
+}
@@ -0,0 +1,137 @@
+#pragma once
+#include "transformations.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+// Pixel transformations on rows of raw channel values of any depth, templated on the channel type (uint8_t or uint16_t).
+// Channels hold values from 0 to maxValue, pixels are either RGB triplets (3 channels) or gray values (1 channel),
+// optionally followed by an alpha channel (4 or 2 channels) which the transformations leave untouched.
+// The formulas are the ones of PixelTransformations, worked out on the channels so no 8-bit HSV conversion is involved.
+namespace ChannelKernels {
+    // Converts big-endian 16-bit values, as stored in PNM files, to the host byte order, clamping them to maxValue.
+    void fromBigEndian(uint16_t *values, size_t count, unsigned maxValue);
+
+    // Converts 16-bit values from the host byte order to big-endian.
+    void toBigEndian(uint16_t *values, size_t count);
+
+    // Returns the number of color channels of pixels with given channel count.
+    inline int getColorChannels(int channels) { return channels < 3 ? 1 : 3; }
+
+    template <typename Channel>
+    void negative(Channel *row, int width, int channels, unsigned maxValue)
+    {
+        if (getColorChannels(channels) == channels)
+        {
+            size_t count = (size_t)width * channels;
+            for (size_t i = 0; i < count; i++)
+                row[i] = maxValue - row[i];
+            return;
+        }
+
+        for (int x = 0; x < width; x++)
+        {
+            Channel *pixel = row + (size_t)x * channels;
+            for (int channel = 0; channel < channels - 1; channel++)
+                pixel[channel] = maxValue - pixel[channel];
+        }
+    }
+
+    template <typename Channel>
+    void grayscale(Channel *row, int width, int channels)
+    {
+        if (getColorChannels(channels) == 1)
+            return;
+
+        for (int x = 0; x < width; x++)
+        {
+            Channel *pixel = row + (size_t)x * channels;
+            Channel value = ((unsigned)pixel[0] + pixel[1] + pixel[2]) / 3;
+            pixel[0] = pixel[1] = pixel[2] = value;
+        }
+    }
+
+    template <typename Channel>
+    void blacknwhite(Channel *row, int width, int channels, unsigned maxValue)
+    {
+        int colors = getColorChannels(channels);
+
+        for (int x = 0; x < width; x++)
+        {
+            Channel *pixel = row + (size_t)x * channels;
+            uint64_t luminance = colors == 1 ? pixel[0] : (300ull * pixel[0] + 587ull * pixel[1] + 114ull * pixel[2]) / 1000;
+            Channel value = luminance > maxValue / 2 ? maxValue : 0;
+
+            for (int channel = 0; channel < colors; channel++)
+                pixel[channel] = value;
+        }
+    }
+
+    // Moves the HSV brightness (the largest channel) by level, given in 8-bit steps. Hue and saturation are kept,
+    // so every channel scales by the same factor.
+    template <typename Channel>
+    void brightness(Channel *row, int width, int channels, int level, unsigned maxValue)
+    {
+        int64_t shift = (int64_t)level * maxValue / 255;
+        int colors = getColorChannels(channels);
+
+        for (int x = 0; x < width; x++)
+        {
+            Channel *pixel = row + (size_t)x * channels;
+            uint64_t value = *std::max_element(pixel, pixel + colors);
+            uint64_t newValue = std::clamp<int64_t>(value + shift, 0, maxValue);
+
+            for (int channel = 0; channel < colors; channel++)
+                pixel[channel] = value == 0 ? newValue : (pixel[channel] * newValue + value / 2) / value;
+        }
+    }
+
+    // Moves the HSV saturation by level percent. Hue and brightness are kept, so every channel keeps its relative
+    // distance from the largest one.
+    template <typename Channel>
+    void saturation(Channel *row, int width, int channels, int level)
+    {
+        if (getColorChannels(channels) == 1)
+            return;
+
+        for (int x = 0; x < width; x++)
+        {
+            Channel *pixel = row + (size_t)x * channels;
+            Channel value = std::max({ pixel[0], pixel[1], pixel[2] });
+            Channel minimum = std::min({ pixel[0], pixel[1], pixel[2] });
+
+            if (value == minimum)
+                continue;
+
+            double saturation = (double)(value - minimum) / value;
+            double newSaturation = std::clamp(saturation + level / 100.0, 0.0, 1.0);
+            double scale = newSaturation / saturation;
+
+            for (int channel = 0; channel < 3; channel++)
+                pixel[channel] = value - (Channel)((value - pixel[channel]) * scale + 0.5);
+        }
+    }
+
+    template <typename Channel>
+    void apply(TRANSFORM_OPERATION operation, Channel *row, int width, int channels, int level, unsigned maxValue)
+    {
+        switch (operation)
+        {
+        case OP_BRIGHTNESS:
+            brightness(row, width, channels, level, maxValue);
+            break;
+        case OP_SATURATION:
+            saturation(row, width, channels, level);
+            break;
+        case OP_GRAYSCALE:
+            grayscale(row, width, channels);
+            break;
+        case OP_NEGATIVE:
+            negative(row, width, channels, maxValue);
+            break;
+        case OP_BLACKNWHITE:
+            blacknwhite(row, width, channels, maxValue);
+            break;
+        }
+    }
+}
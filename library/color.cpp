@@ -1,4 +1,6 @@
 #include "color.h"
+#include <algorithm>
+#include <cstdlib>
 
 RGBColor Conversions::HSVToRGB(HSVColor hsv)
 {
@@ -120,6 +122,147 @@ HSVColor Conversions::RGBToHSV(Pixel pixel)
     return RGBToHSV(RGBColor(pixel.r, pixel.g, pixel.b));
 }
 
+// Reciprocals for the bulk conversions. floor(n / d) == (n * integerReciprocals[d]) >> 32 for all n below 2^32 / 255.
+struct ReciprocalTables {
+    uint64_t integerReciprocals[256];
+    float floatReciprocals[256];
+
+    ReciprocalTables()
+    {
+        integerReciprocals[0] = 0;
+        floatReciprocals[0] = 0;
+        for (int d = 1; d < 256; d++)
+        {
+            integerReciprocals[d] = ((1ull << 32) + d - 1) / d;
+            floatReciprocals[d] = 1.0f / d;
+        }
+    }
+};
+
+static const ReciprocalTables reciprocals;
+
+static inline unsigned divideByte(unsigned numerator, unsigned denominator)
+{
+    return (numerator * reciprocals.integerReciprocals[denominator]) >> 32;
+}
+
+// Computes the hue (0-359) like RGBToHSV does, rounding toward zero for red and down for green and blue
+static inline int hueOf(int r, int g, int b, int colorMax, int delta)
+{
+    if (delta == 0)
+        return 0;
+
+    int base = (colorMax == r) ? 0 : (colorMax == g ? 120 : 240);
+    int difference = (colorMax == r) ? g - b : (colorMax == g ? b - r : r - g);
+    unsigned numerator = 60 * std::abs(difference);
+    int quotient = divideByte(numerator, delta);
+
+    if (difference >= 0)
+        return base + quotient;
+    if (base == 0)
+        return quotient == 0 ? 0 : 360 - quotient;
+
+    bool exact = quotient * delta == (int)numerator;
+    return base - quotient - (exact ? 0 : 1);
+}
+
+static inline Pixel fixedHSVToPixel(unsigned hue, unsigned saturation, unsigned brightness)
+{
+    unsigned chroma = (brightness * saturation + 32767) / 65535;
+    unsigned sector = hue / 60;
+    unsigned rising = (chroma * (hue - sector * 60) + 30) / 60;
+    unsigned falling = chroma - rising;
+    unsigned minimum = brightness - chroma;
+
+    unsigned r = (sector == 0 || sector == 5) ? chroma : (sector == 1 ? falling : (sector == 4 ? rising : 0));
+    unsigned g = (sector == 1 || sector == 2) ? chroma : (sector == 0 ? rising : (sector == 3 ? falling : 0));
+    unsigned b = (sector == 3 || sector == 4) ? chroma : (sector == 2 ? rising : (sector == 5 ? falling : 0));
+
+    return Pixel(r + minimum, g + minimum, b + minimum);
+}
+
+void Conversions::RGBToHSV(const Pixel *pixels, HSVColor *result, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        int r = pixels[i].r;
+        int g = pixels[i].g;
+        int b = pixels[i].b;
+        int colorMax = std::max(r, std::max(g, b));
+        int delta = colorMax - std::min(r, std::min(g, b));
+
+        result[i].hue = hueOf(r, g, b, colorMax, delta);
+        result[i].saturation = delta * reciprocals.floatReciprocals[colorMax];
+        result[i].brightness = colorMax;
+    }
+}
+
+void Conversions::HSVToRGB(const HSVColor *colors, Pixel *result, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        int hue = colors[i].hue % 360;
+        float saturation = std::min(std::max(colors[i].saturation, 0.0f), 1.0f);
+        int brightness = std::min(std::max(colors[i].brightness, 0), 255);
+
+        if (hue < 0)
+            hue += 360;
+
+        result[i] = fixedHSVToPixel(hue, (unsigned)(saturation * 65535 + 0.5f), brightness);
+    }
+}
+
+void Conversions::RGBToHSV(const Pixel *pixels, HSVPlanes &result, size_t count)
+{
+    uint16_t *hue = result.hue.data();
+    uint16_t *saturation = result.saturation.data();
+    uint8_t *brightness = result.brightness.data();
+
+    for (size_t i = 0; i < count; i++)
+    {
+        int r = pixels[i].r;
+        int g = pixels[i].g;
+        int b = pixels[i].b;
+        int colorMax = std::max(r, std::max(g, b));
+        int delta = colorMax - std::min(r, std::min(g, b));
+
+        hue[i] = hueOf(r, g, b, colorMax, delta);
+        saturation[i] = divideByte(delta * 65535, colorMax);
+        brightness[i] = colorMax;
+    }
+}
+
+void Conversions::HSVToRGB(const HSVPlanes &planes, Pixel *result, size_t count)
+{
+    const uint16_t *hue = planes.hue.data();
+    const uint16_t *saturation = planes.saturation.data();
+    const uint8_t *brightness = planes.brightness.data();
+
+    for (size_t i = 0; i < count; i++)
+        result[i] = fixedHSVToPixel(hue[i], saturation[i], brightness[i]);
+}
+
+HSVPlanes::HSVPlanes()
+{
+}
+
+HSVPlanes::HSVPlanes(size_t count)
+{
+    resize(count);
+}
+
+void HSVPlanes::resize(size_t count)
+{
+    hue.resize(count);
+    saturation.resize(count);
+    brightness.resize(count);
+}
+
+size_t HSVPlanes::size() const
+{
+    return hue.size();
+}
+
 RGBColor::RGBColor()
 {
 }
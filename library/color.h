@@ -1,6 +1,8 @@
 #pragma once
 #include "pixel.h"
 #include "cmath"
+#include <cstddef>
+#include <vector>
 // #include <cstdint>
 
 struct RGBColor {
@@ -25,8 +27,36 @@ struct HSVColor {
     HSVColor(int _hue, float _saturation, int _brightness) : hue(_hue), saturation(_saturation), brightness(_brightness) {};
 };
 
+// HSV colors stored as separate planes in fixed-point, for bulk conversions and bulk HSV-space operations.
+struct HSVPlanes {
+    // Hue (0-359)
+    std::vector<uint16_t> hue;
+    // Saturation (0-65535, meaning 0-1)
+    std::vector<uint16_t> saturation;
+    // Brightness (0-255)
+    std::vector<uint8_t> brightness;
+
+    HSVPlanes();
+    HSVPlanes(size_t count);
+
+    // Resizes all the planes to hold given number of colors.
+    void resize(size_t count);
+
+    // Returns the number of colors held.
+    size_t size() const;
+};
+
 namespace Conversions {
     RGBColor HSVToRGB(HSVColor hsv);
     HSVColor RGBToHSV(RGBColor rgb);
     HSVColor RGBToHSV(Pixel pixel);
+
+    // Bulk conversions in integer arithmetic, without divisions in the loop. Hue and brightness match the per-pixel
+    // conversions, saturation is within 1/65535, and the channels of HSVToRGB may differ by up to two, due to rounding.
+    void RGBToHSV(const Pixel *pixels, HSVColor *result, size_t count);
+    void HSVToRGB(const HSVColor *colors, Pixel *result, size_t count);
+
+    // Bulk conversions between pixels and planar fixed-point HSV. The planes must hold at least count colors.
+    void RGBToHSV(const Pixel *pixels, HSVPlanes &result, size_t count);
+    void HSVToRGB(const HSVPlanes &planes, Pixel *result, size_t count);
 }
\ No newline at end of file
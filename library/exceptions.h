@@ -89,4 +89,17 @@ private:
 public:
   bitmap_size_mismatch(const char *msg) : message(msg) {}
   const char *what() const throw() { return message.c_str(); }
-};
\ No newline at end of file
+};
+
+class file_access_exception : public std::exception
+{
+private:
+    std::string message;
+
+public:
+    file_access_exception(const char *msg) : message(msg) {}
+    const char *what() const throw()
+    {
+        return message.c_str();
+    }
+};
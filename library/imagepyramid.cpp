@@ -0,0 +1,242 @@
+#include "imagepyramid.h"
+#include "bitmap.h"
+#include "pixelformat.h"
+#include "simdkernels.h"
+#include "workerpool.h"
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <functional>
+
+void ImagePyramid::invalidate(int x, int y, int width, int height)
+{
+    if (width <= 0 || height <= 0)
+        return;
+
+    if (dirtyRight <= dirtyLeft)
+    {
+        dirtyLeft = x;
+        dirtyTop = y;
+        dirtyRight = x + width;
+        dirtyBottom = y + height;
+        return;
+    }
+
+    dirtyLeft = std::min(dirtyLeft, x);
+    dirtyTop = std::min(dirtyTop, y);
+    dirtyRight = std::max(dirtyRight, x + width);
+    dirtyBottom = std::max(dirtyBottom, y + height);
+}
+
+void ImagePyramid::invalidate()
+{
+    // clamped to the bitmap on update
+    dirtyLeft = 0;
+    dirtyTop = 0;
+    dirtyRight = INT_MAX;
+    dirtyBottom = INT_MAX;
+}
+
+void ImagePyramid::clear()
+{
+    levels.clear();
+    levels.shrink_to_fit();
+    invalidate();
+}
+
+void ImagePyramid::update(Bitmap &bitmap)
+{
+    int width = bitmap.hasOpenBitmap() ? bitmap.getWidth() : 0;
+    int height = bitmap.hasOpenBitmap() ? bitmap.getHeight() : 0;
+    PIXEL_FORMAT bitmapFormat = bitmap.hasOpenBitmap() ? bitmap.getPixelFormat() : FORMAT_RGB;
+    PIXEL_FORMAT levelFormat = getLevelFormat(bitmapFormat);
+    int levelsFirst = getFirstLevel(width, height, bitmapFormat);
+
+    if (levels.empty() || levels[0].width != width || levels[0].height != height || format != levelFormat || firstLevel != levelsFirst)
+    {
+        levels.clear();
+        levels.push_back(Level{width, height, {}});
+        format = levelFormat;
+        firstLevel = levelsFirst;
+
+        while (width > 1 || height > 1)
+        {
+            width = (width + 1) / 2;
+            height = (height + 1) / 2;
+
+            bool isStored = firstLevel > 0 && (int)levels.size() >= firstLevel;
+            levels.push_back(Level{width, height, std::vector<uint8_t>(isStored ? PixelFormats::getRowSize(width, format) * height : 0)});
+        }
+
+        invalidate();
+    }
+
+    int left = std::max(dirtyLeft, 0);
+    int top = std::max(dirtyTop, 0);
+    int right = std::min(dirtyRight, levels[0].width);
+    int bottom = std::min(dirtyBottom, levels[0].height);
+
+    if (right <= left || bottom <= top || firstLevel == 0)
+    {
+        dirtyRight = dirtyLeft;
+        return;
+    }
+
+    // the rows are read from several threads
+    bitmap.applyPendingOperations();
+
+    // bilevel rows are converted from whole bytes, so the region starts at a multiple of 8 pixels
+    left = left / 8 * 8;
+
+    for (int level = 1; level < (int)levels.size(); level++)
+    {
+        left /= 2;
+        top /= 2;
+        right = (right + 1) / 2;
+        bottom = (bottom + 1) / 2;
+
+        if (level >= firstLevel)
+            downsampleRegion(bitmap, level, left, top, right, bottom);
+    }
+
+    dirtyRight = dirtyLeft;
+}
+
+int ImagePyramid::getLevelCount() const
+{
+    return (int)levels.size();
+}
+
+int ImagePyramid::getLevelWidth(int level) const
+{
+    return levels[level].width;
+}
+
+int ImagePyramid::getLevelHeight(int level) const
+{
+    return levels[level].height;
+}
+
+int ImagePyramid::getFirstLevel() const
+{
+    return firstLevel;
+}
+
+int ImagePyramid::getFirstLevel(int width, int height, PIXEL_FORMAT bitmapFormat)
+{
+    PIXEL_FORMAT levelFormat = getLevelFormat(bitmapFormat);
+    std::vector<size_t> levelSizes;
+    size_t totalSize = 0;
+
+    while (width > 1 || height > 1)
+    {
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+        levelSizes.push_back(PixelFormats::getRowSize(width, levelFormat) * height);
+        totalSize += levelSizes.back();
+    }
+
+    // each level takes about 3 times the size of all the smaller ones, so leaving out the largest goes a long way
+    size_t budget = Bitmap::getMemoryBudget();
+    for (size_t index = 0; index < levelSizes.size(); index++)
+    {
+        if (totalSize <= budget)
+            return (int)index + 1;
+        totalSize -= levelSizes[index];
+    }
+
+    return 0;
+}
+
+PIXEL_FORMAT ImagePyramid::getLevelFormat() const
+{
+    return format;
+}
+
+PIXEL_FORMAT ImagePyramid::getLevelFormat(PIXEL_FORMAT bitmapFormat)
+{
+    return PixelFormats::isGray(bitmapFormat) ? FORMAT_GRAY : FORMAT_RGB;
+}
+
+const uint8_t *ImagePyramid::getRow(int level, int y) const
+{
+    return levels[level].pixels.data() + (size_t)y * PixelFormats::getRowSize(levels[level].width, format);
+}
+
+void ImagePyramid::downsampleRegion(Bitmap &bitmap, int level, int left, int top, int right, int bottom)
+{
+    int sourceLevel = level - 1;
+    while (sourceLevel > 0 && levels[sourceLevel].pixels.empty())
+        sourceLevel--;
+
+    // columns [firstColumns[step], firstColumns[step] + columnCounts[step]) of level sourceLevel + step lie under the region,
+    // the last column and row of odd sized levels average the source edge with itself
+    int steps = level - sourceLevel;
+    std::vector<int> firstColumns(steps + 1);
+    std::vector<int> columnCounts(steps + 1);
+    for (int step = 0; step <= steps; step++)
+    {
+        int shift = steps - step;
+        firstColumns[step] = left << shift;
+        columnCounts[step] = (int)std::min((int64_t)right << shift, (int64_t)levels[sourceLevel + step].width) - firstColumns[step];
+    }
+
+    PIXEL_FORMAT bitmapFormat = bitmap.getPixelFormat();
+    int maxValue = bitmap.getMaxValue();
+    Level &destination = levels[level];
+    size_t destinationRowSize = PixelFormats::getRowSize(destination.width, format);
+
+    WorkerPool::getInstance().forEachRowBand(bottom - top, [&](int firstRow, int lastRow) {
+        // two rows of each level on the way, the ones averaged into a row of the next level
+        std::vector<std::vector<Pixel>> rows(steps + 1);
+        for (int step = 0; step <= steps; step++)
+            rows[step].resize(2 * (size_t)columnCounts[step]);
+
+        // RGB rows of the bitmap and the source level are used where they are, the others go through RGB pixels
+        std::function<const Pixel *(int, int, int)> getLevelRow = [&](int step, int y, int slot) -> const Pixel * {
+            Pixel *row = rows[step].data() + (size_t)slot * columnCounts[step];
+
+            if (step == 0 && sourceLevel == 0)
+            {
+                if (bitmapFormat == FORMAT_RGB)
+                    return bitmap.getRow(y) + firstColumns[0];
+
+                PixelFormats::toPixels(bitmap.getRowData(y) + PixelFormats::getRowSize(firstColumns[0], bitmapFormat), bitmapFormat, row, columnCounts[0], maxValue);
+                return row;
+            }
+
+            if (step == 0)
+            {
+                const uint8_t *sourceRow = getRow(sourceLevel, y) + PixelFormats::getRowSize(firstColumns[0], format);
+                if (format == FORMAT_RGB)
+                    return reinterpret_cast<const Pixel *>(sourceRow);
+
+                PixelFormats::toPixels(sourceRow, format, row, columnCounts[0]);
+                return row;
+            }
+
+            // the upper row stays in slot 0 of its level while the lower one is computed
+            const Pixel *row1 = getLevelRow(step - 1, 2 * y, 0);
+            const Pixel *row2 = 2 * y + 1 < levels[sourceLevel + step - 1].height ? getLevelRow(step - 1, 2 * y + 1, 1) : row1;
+            int sourceCount = columnCounts[step - 1];
+            int pairCount = sourceCount / 2;
+
+            SimdKernels::downsample(row1, row2, row, pairCount);
+
+            if (sourceCount % 2)
+            {
+                Pixel upper = row1[sourceCount - 1];
+                Pixel lower = row2[sourceCount - 1];
+                row[pairCount] = Pixel((upper.r + lower.r + 1) / 2, (upper.g + lower.g + 1) / 2, (upper.b + lower.b + 1) / 2);
+            }
+
+            return row;
+        };
+
+        for (int y = top + firstRow; y < top + lastRow; y++)
+        {
+            uint8_t *row = destination.pixels.data() + (size_t)y * destinationRowSize + PixelFormats::getRowSize(left, format);
+            PixelFormats::fromPixels(getLevelRow(steps, y, 0), row, format, columnCounts[steps]);
+        }
+    });
+}
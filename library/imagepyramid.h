@@ -0,0 +1,70 @@
+#pragma once
+#include "pixel.h"
+#include "pixelformat.h"
+#include <cstdint>
+#include <vector>
+
+class Bitmap;
+
+// Successive halvings of a bitmap for showing it zoomed out, down to a single pixel. Each level is a 2x2 box average
+// of the one before, stored as 8-bit gray for gray and black and white bitmaps, 8-bit RGB otherwise. Level 0 is the bitmap
+// itself, so it is read from the bitmap, not stored here. The stored levels are held to the memory budget of a bitmap,
+// the largest ones are left out until the others fit, and computed on the way to the first one stored.
+// Changes only mark regions, the levels are recomputed over them on the next update.
+class ImagePyramid {
+    public:
+        // Marks given region of the bitmap as changed.
+        void invalidate(int x, int y, int width, int height);
+
+        // Marks the whole bitmap as changed.
+        void invalidate();
+
+        // Drops the levels, to free their memory. The next update computes them all again.
+        void clear();
+
+        // Recomputes the parts of the levels over the changed regions, reading the bitmap from several threads.
+        // The levels are laid out again if the dimensions of the bitmap changed.
+        void update(Bitmap &bitmap);
+
+        // Returns the number of levels, level 0 included. Only valid after an update.
+        int getLevelCount() const;
+
+        int getLevelWidth(int level) const;
+        int getLevelHeight(int level) const;
+
+        // Returns the smallest level stored, 0 if none is. Only valid after an update.
+        int getFirstLevel() const;
+
+        // Returns the smallest level stored for a bitmap of given dimensions and format, 0 if none fits the memory budget.
+        static int getFirstLevel(int width, int height, PIXEL_FORMAT bitmapFormat);
+
+        // Returns the format of the rows of the stored levels, FORMAT_GRAY or FORMAT_RGB.
+        PIXEL_FORMAT getLevelFormat() const;
+
+        // Returns row y of given stored level, in the format of the levels.
+        const uint8_t *getRow(int level, int y) const;
+    private:
+        struct Level
+        {
+            int width = 0;
+            int height = 0;
+            // Rows of width pixels in the format of the levels, empty for level 0 and the levels left out
+            std::vector<uint8_t> pixels;
+        };
+
+        // Returns the format of the levels of a bitmap in given format
+        static PIXEL_FORMAT getLevelFormat(PIXEL_FORMAT bitmapFormat);
+
+        // Recomputes the rectangle [left, right) x [top, bottom) of a stored level from the closest one stored below,
+        // or the bitmap, going through the levels left out between them
+        void downsampleRegion(Bitmap &bitmap, int level, int left, int top, int right, int bottom);
+
+        std::vector<Level> levels;
+        PIXEL_FORMAT format = FORMAT_RGB;
+        int firstLevel = 0;
+        // The changed region of level 0, empty when right <= left
+        int dirtyLeft = 0;
+        int dirtyTop = 0;
+        int dirtyRight = 0;
+        int dirtyBottom = 0;
+};
@@ -0,0 +1,154 @@
+#include "lookuptable.h"
+#include "bitmap.h"
+#include <algorithm>
+#include <cstdlib>
+#include <list>
+#include <mutex>
+#include <new>
+#include <utility>
+#define COLOR_COUNT (1 << 24)
+// The cache holds at most this many bytes of tables, two full color tables, and at most this share of the memory budget
+#define MAX_CACHED_BYTES ((size_t)128 << 20)
+#define CACHE_BUDGET_SHARE 8
+
+LookupTable::LookupTable(std::function<Pixel(Pixel)> transformFunction, bool separable)
+    : transformFunction(transformFunction), separable(separable)
+{
+    if (separable)
+    {
+        for (int value = 0; value < 256; value++)
+        {
+            Pixel transformed = transformFunction(Pixel(value, value, value));
+            channelTables[0][value] = transformed.r;
+            channelTables[1][value] = transformed.g;
+            channelTables[2][value] = transformed.b;
+        }
+    }
+    else
+    {
+        // calloc lets the OS hand out zeroed pages on first touch, so only the parts of the cube in use take memory
+        colorTable = static_cast<uint32_t *>(std::calloc(COLOR_COUNT, sizeof(uint32_t)));
+        if (!colorTable)
+            throw std::bad_alloc();
+    }
+}
+
+LookupTable::~LookupTable()
+{
+    std::free(colorTable);
+}
+
+uint32_t LookupTable::computeEntry(uint32_t index) const
+{
+    Pixel transformed = transformFunction(Pixel(index >> 16, index >> 8, index));
+    uint32_t entry = COMPUTED_FLAG | (transformed.r << 16) | (transformed.g << 8) | transformed.b;
+
+    // threads racing for the same color store the same value
+    storeEntry(colorTable + index, entry);
+    return entry;
+}
+
+void LookupTable::applyToRow(Pixel *row, int width) const
+{
+    if (separable)
+    {
+        for (int x = 0; x < width; x++)
+            row[x] = Pixel(channelTables[0][row[x].r], channelTables[1][row[x].g], channelTables[2][row[x].b]);
+    }
+    else
+    {
+        for (int x = 0; x < width; x++)
+            row[x] = apply(row[x]);
+    }
+}
+
+bool LookupTable::isSeparable() const
+{
+    return separable;
+}
+
+size_t LookupTable::getMemUsage() const
+{
+    return sizeof(LookupTable) + (colorTable ? (size_t)COLOR_COUNT * sizeof(uint32_t) : 0);
+}
+
+namespace TransformCompiler
+{
+    typedef std::vector<std::pair<TRANSFORM_OPERATION, int>> cacheKey;
+
+    // Most recently used first
+    static std::list<std::pair<cacheKey, std::shared_ptr<const LookupTable>>> cache;
+    static std::mutex cacheMutex;
+
+    static bool hasLevel(TRANSFORM_OPERATION operation)
+    {
+        return operation == OP_BRIGHTNESS || operation == OP_SATURATION;
+    }
+
+    bool isSeparable(TRANSFORM_OPERATION operation)
+    {
+        return operation == OP_NEGATIVE;
+    }
+
+    // Drops the least recently used tables past the size limit, always keeping the newest one. Callers hold cacheMutex.
+    static void dropOldestTables()
+    {
+        size_t limit = std::min(MAX_CACHED_BYTES, Bitmap::getMemoryBudget() / CACHE_BUDGET_SHARE);
+        size_t cachedBytes = 0;
+
+        for (auto &entry : cache)
+            cachedBytes += entry.second->getMemUsage();
+
+        while (cachedBytes > limit && cache.size() > 1)
+        {
+            cachedBytes -= cache.back().second->getMemUsage();
+            cache.pop_back();
+        }
+    }
+
+    std::shared_ptr<const LookupTable> compile(TRANSFORM_OPERATION operation, int level)
+    {
+        return compile(cacheKey{ { operation, level } });
+    }
+
+    std::shared_ptr<const LookupTable> compile(const std::vector<std::pair<TRANSFORM_OPERATION, int>> &chain)
+    {
+        // chains differing only in ignored levels share a table
+        cacheKey key = chain;
+        bool separable = true;
+        for (auto &stage : key)
+        {
+            if (!hasLevel(stage.first))
+                stage.second = 0;
+            separable = separable && isSeparable(stage.first);
+        }
+
+        std::lock_guard<std::mutex> lock(cacheMutex);
+
+        for (auto it = cache.begin(); it != cache.end(); it++)
+        {
+            if (it->first == key)
+            {
+                cache.splice(cache.begin(), cache, it);
+                return it->second;
+            }
+        }
+
+        std::shared_ptr<const LookupTable> table = std::make_shared<const LookupTable>([key](Pixel pixel) {
+            for (const auto &stage : key)
+                pixel = PixelTransformations::apply(stage.first, pixel, stage.second);
+            return pixel;
+        }, separable);
+
+        cache.emplace_front(key, table);
+        dropOldestTables();
+
+        return table;
+    }
+
+    void clearCache()
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        cache.clear();
+    }
+}
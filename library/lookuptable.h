@@ -0,0 +1,94 @@
+#pragma once
+#include "pixel.h"
+#include "transformations.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// A pixel transformation precomputed into tables, applied with a lookup per pixel.
+// Separable transformations (each channel depends only on itself) use three 256-entry channel tables.
+// Others use a table covering the whole RGB cube, which is filled lazily, the first time each color is met.
+// Lookups are thread-safe, so one table can be shared by all workers.
+class LookupTable {
+    public:
+        // Compiles given transformation. It must be thread-safe, as the lazy table calls it from the threads doing lookups.
+        LookupTable(std::function<Pixel(Pixel)> transformFunction, bool separable);
+
+        LookupTable(const LookupTable&) = delete;
+        LookupTable& operator=(const LookupTable&) = delete;
+
+        ~LookupTable();
+
+        // Returns the transformed pixel.
+        Pixel apply(Pixel pixel) const
+        {
+            if (separable)
+                return Pixel(channelTables[0][pixel.r], channelTables[1][pixel.g], channelTables[2][pixel.b]);
+
+            uint32_t index = (pixel.r << 16) | (pixel.g << 8) | pixel.b;
+            uint32_t entry = loadEntry(colorTable + index);
+
+            if (!(entry & COMPUTED_FLAG))
+                entry = computeEntry(index);
+
+            return Pixel(entry >> 16, entry >> 8, entry);
+        }
+
+        // Transforms a whole row in place.
+        void applyToRow(Pixel *row, int width) const;
+
+        // Returns if the transformation is looked up per channel.
+        bool isSeparable() const;
+
+        // Returns the number of bytes reserved by the tables.
+        size_t getMemUsage() const;
+    private:
+        static const uint32_t COMPUTED_FLAG = 1u << 24;
+
+        uint32_t computeEntry(uint32_t index) const;
+
+        // Relaxed atomic accesses to the entries, which are plain integers so the zeroed pages of calloc can hold them
+        static uint32_t loadEntry(const uint32_t *entry)
+        {
+#if defined(__GNUC__) || defined(__clang__)
+            return __atomic_load_n(entry, __ATOMIC_RELAXED);
+#else
+            // aligned 32-bit volatile accesses are atomic on the platforms MSVC targets
+            return *reinterpret_cast<const volatile uint32_t *>(entry);
+#endif
+        }
+
+        static void storeEntry(uint32_t *entry, uint32_t value)
+        {
+#if defined(__GNUC__) || defined(__clang__)
+            __atomic_store_n(entry, value, __ATOMIC_RELAXED);
+#else
+            *reinterpret_cast<volatile uint32_t *>(entry) = value;
+#endif
+        }
+
+        std::function<Pixel(Pixel)> transformFunction;
+        bool separable;
+        uint8_t channelTables[3][256];
+        // 2^24 entries of 0x01RRGGBB, 0 until computed
+        uint32_t *colorTable = nullptr;
+};
+
+// Compiles the built-in transformations into lookup tables, and keeps the recently used ones cached by their chain of (operation, level).
+// The cache is bounded in bytes, to two full color tables or an eighth of the memory budget of bitmaps, whichever is less.
+namespace TransformCompiler {
+    // Returns the lookup table for given operation and level. Level is ignored by operations without one.
+    std::shared_ptr<const LookupTable> compile(TRANSFORM_OPERATION operation, int level = 0);
+
+    // Returns the lookup table for given operations and levels applied in order, each color running through the whole chain once.
+    std::shared_ptr<const LookupTable> compile(const std::vector<std::pair<TRANSFORM_OPERATION, int>> &chain);
+
+    // Returns if given operation can be looked up per channel.
+    bool isSeparable(TRANSFORM_OPERATION operation);
+
+    // Drops all cached tables. Tables still in use are freed once released.
+    void clearCache();
+}
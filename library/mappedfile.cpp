@@ -0,0 +1,207 @@
+#include "mappedfile.h"
+#include "exceptions.h"
+#include <cstdlib>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+MappedFile::MappedFile(const std::string &path) : mode(MAPPING_READ_ONLY)
+{
+    fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+    {
+        fileHandle = nullptr;
+        throw file_access_exception("Could not open the file");
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(fileHandle, &fileSize))
+    {
+        CloseHandle(fileHandle);
+        throw file_access_exception("Could not read the file size");
+    }
+
+    size = (size_t)fileSize.QuadPart;
+
+    // empty files can't be mapped, and there is nothing to read anyway
+    if (size == 0)
+        return;
+
+    mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mappingHandle)
+        data = static_cast<char *>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+
+    if (!data)
+    {
+        if (mappingHandle)
+            CloseHandle(mappingHandle);
+        CloseHandle(fileHandle);
+        throw file_access_exception("Could not map the file into memory");
+    }
+}
+
+MappedFile::MappedFile(size_t size, const std::string &directory) : size(size), mode(MAPPING_SCRATCH)
+{
+    char path[MAX_PATH];
+    if (!GetTempFileNameA(directory.c_str(), "pam", 0, path))
+        throw file_access_exception("Could not create the scratch file");
+
+    // the file goes away with its last handle, even if the process doesn't end well
+    fileHandle = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                             FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+    {
+        fileHandle = nullptr;
+        DeleteFileA(path);
+        throw file_access_exception("Could not create the scratch file");
+    }
+
+    // the mapping extends the file to its size, so there is room for every page before any is written
+    LARGE_INTEGER mappingSize;
+    mappingSize.QuadPart = (LONGLONG)size;
+    mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READWRITE, mappingSize.HighPart, mappingSize.LowPart, nullptr);
+    if (mappingHandle)
+        data = static_cast<char *>(MapViewOfFile(mappingHandle, FILE_MAP_WRITE, 0, 0, 0));
+
+    if (!data)
+    {
+        if (mappingHandle)
+            CloseHandle(mappingHandle);
+        CloseHandle(fileHandle);
+        throw file_access_exception("Could not map the scratch file into memory");
+    }
+}
+
+MappedFile::~MappedFile()
+{
+    if (data)
+        UnmapViewOfFile(data);
+    if (mappingHandle)
+        CloseHandle(mappingHandle);
+    if (fileHandle)
+        CloseHandle(fileHandle);
+}
+#else
+MappedFile::MappedFile(const std::string &path) : mode(MAPPING_READ_ONLY)
+{
+    int fileDescriptor = ::open(path.c_str(), O_RDONLY);
+    if (fileDescriptor < 0)
+        throw file_access_exception("Could not open the file");
+
+    struct stat fileStatus;
+    if (fstat(fileDescriptor, &fileStatus) != 0 || !S_ISREG(fileStatus.st_mode))
+    {
+        ::close(fileDescriptor);
+        throw file_access_exception("Not a regular file");
+    }
+
+    size = (size_t)fileStatus.st_size;
+
+    // empty files can't be mapped, and there is nothing to read anyway
+    if (size > 0)
+    {
+        void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+
+        if (mapping == MAP_FAILED)
+        {
+            ::close(fileDescriptor);
+            throw file_access_exception("Could not map the file into memory");
+        }
+
+        data = static_cast<char *>(mapping);
+        madvise(data, size, MADV_SEQUENTIAL);
+    }
+
+    // the mapping stays valid after the descriptor is closed
+    ::close(fileDescriptor);
+}
+
+MappedFile::MappedFile(size_t size, const std::string &directory) : size(size), mode(MAPPING_SCRATCH)
+{
+    std::string pattern = directory + "/pamview-XXXXXX";
+    std::vector<char> path(pattern.begin(), pattern.end());
+    path.push_back('\0');
+
+    int fileDescriptor = mkstemp(path.data());
+    if (fileDescriptor < 0)
+        throw file_access_exception("Could not create the scratch file");
+
+    // the file has no name from now on, so it goes away with the mapping, even if the process doesn't end well
+    unlink(path.data());
+
+    // the blocks are reserved up front, a sparse file running out of disk would fault on a write instead
+    if (posix_fallocate(fileDescriptor, 0, (off_t)size) != 0)
+    {
+        ::close(fileDescriptor);
+        throw file_access_exception("Not enough disk space for the scratch file");
+    }
+
+    void *mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fileDescriptor, 0);
+    ::close(fileDescriptor);
+
+    if (mapping == MAP_FAILED)
+        throw file_access_exception("Could not map the scratch file into memory");
+
+    data = static_cast<char *>(mapping);
+}
+
+MappedFile::~MappedFile()
+{
+    if (data)
+        munmap(data, size);
+}
+#endif
+
+const char *MappedFile::getData() const
+{
+    return data;
+}
+
+char *MappedFile::getWritableData()
+{
+    return data;
+}
+
+size_t MappedFile::getSize() const
+{
+    return size;
+}
+
+MAPPING_MODE MappedFile::getMode() const
+{
+    return mode;
+}
+
+MemoryStreamBuffer::MemoryStreamBuffer(const char *data, size_t size)
+{
+    // the get area is never written to, streambuf just isn't const-correct
+    char *begin = const_cast<char *>(data);
+    setg(begin, begin, begin + size);
+}
+
+MemoryStreamBuffer::pos_type MemoryStreamBuffer::seekoff(off_type offset, std::ios_base::seekdir direction, std::ios_base::openmode which)
+{
+    if (!(which & std::ios_base::in))
+        return pos_type(off_type(-1));
+
+    char *origin = direction == std::ios_base::beg ? eback() : (direction == std::ios_base::cur ? gptr() : egptr());
+
+    if (offset < eback() - origin || offset > egptr() - origin)
+        return pos_type(off_type(-1));
+
+    setg(eback(), origin + offset, egptr());
+    return pos_type(off_type(gptr() - eback()));
+}
+
+MemoryStreamBuffer::pos_type MemoryStreamBuffer::seekpos(pos_type position, std::ios_base::openmode which)
+{
+    return seekoff(off_type(position), std::ios_base::beg, which);
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <cstddef>
+#include <streambuf>
+#include <string>
+
+// Represents how the mapped file pages can be accessed
+enum MAPPING_MODE
+{
+    // Pages can only be read
+    MAPPING_READ_ONLY,
+    // Pages can be written, and are written back to a temporary file deleted along with the mapping
+    MAPPING_SCRATCH
+};
+
+// A whole file mapped into memory. Pages are loaded by the OS on first access, and shared with the file cache until written.
+class MappedFile {
+    public:
+        // Maps given file for reading. Throws file_access_exception if it can't be opened or mapped.
+        MappedFile(const std::string &path);
+
+        // Creates a scratch file of given size in given directory and maps it for writing. The OS keeps the pages in use
+        // in memory and writes the others back to the file, not to the swap. Throws file_access_exception if the file
+        // can't be created or the disk has no room for it.
+        MappedFile(size_t size, const std::string &directory);
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        ~MappedFile();
+
+        // Returns the first byte of the file.
+        const char *getData() const;
+
+        // Returns the first byte of the file, for writing. Only valid for scratch mappings.
+        char *getWritableData();
+
+        // Returns the file size in bytes.
+        size_t getSize() const;
+
+        MAPPING_MODE getMode() const;
+    private:
+        char *data = nullptr;
+        size_t size = 0;
+        MAPPING_MODE mode;
+#ifdef _WIN32
+        void *fileHandle = nullptr;
+        void *mappingHandle = nullptr;
+#endif
+};
+
+// A read-only stream buffer over memory, so the stream based parsing works directly on a mapped file.
+class MemoryStreamBuffer : public std::streambuf {
+    public:
+        MemoryStreamBuffer(const char *data, size_t size);
+
+    protected:
+        pos_type seekoff(off_type offset, std::ios_base::seekdir direction, std::ios_base::openmode which) override;
+        pos_type seekpos(pos_type position, std::ios_base::openmode which) override;
+};
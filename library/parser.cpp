@@ -1,156 +1,398 @@
 #include "parser.h"
+#include "asciiscanner.h"
 #include "exceptions.h"
+#include "mappedfile.h"
+#include "rowstream.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <vector>
 #define COMMENT_CHAR '#'
-#define MAX_PIXELS 100000000
 #define PROGRESS_BAR_UPDATE_TRESHOLD 10000
+#define PARALLEL_ASCII_MIN_BYTES (1 << 20)
+#define ASCII_CHUNKS_PER_WORKER 4
 // #define STREAM_EOF_EXCEPTION std::invalid_argument("Reached end of stream while reading data (EOF)")
 // #define PARSE_NUM_FAILED std::invalid_argument("Failed to parse a number. File is corrupt")
 // #define STREAM_CORRUPT_EXCEPTION std::invalid_argument("Stream is corrupt. Fatal error reading the data")
 
 void Parser::loadToBitmap(Bitmap &bitmap, std::istream &stream, std::function<void(int)> progressHandler)
 {
+    RowReader reader(stream);
+
+    readRowsToBitmap(bitmap, reader, progressHandler);
+}
+
+void Parser::loadFromFile(Bitmap &bitmap, const std::string &path, std::function<void(int)> progressHandler)
+{
+    std::shared_ptr<MappedFile> file;
+
+    try
+    {
+        file = std::make_shared<MappedFile>(path);
+    }
+    catch (file_access_exception &)
+    {
+        // not mappable (like a pipe), so read it as a regular stream
+        std::ifstream fileStream(path, std::ios::binary);
+        if (!fileStream)
+            throw;
+        loadToBitmap(bitmap, fileStream, progressHandler);
+        return;
+    }
+
+    MemoryStreamBuffer buffer(file->getData(), file->getSize());
+    std::istream stream(&buffer);
+
+    BitmapHeader header = readHeader(stream);
+
+    // raw 8-bit rows (and bilevel rows) are stored exactly like the bitmap rows of their pixel format
+    PIXEL_FORMAT pixelFormat = getPixelFormat(header);
+    bool isRaw = header.filetype >= P4;
+    bool isStoredAsIs = pixelFormat == FORMAT_BILEVEL ? header.filetype == P4 : header.maxValue == 255;
+
+    size_t pixelDataOffset = (size_t)stream.tellg();
+    size_t rowSize = PixelFormats::getRowSize(header.width, pixelFormat);
+
+    // absurd dimensions wrap the byte count around, they are refused when the bitmap is created
+    bool fitsAddressSpace = rowSize <= SIZE_MAX / header.height;
+    size_t pixelDataSize = rowSize * header.height;
+
+    if (isRaw && isStoredAsIs && fitsAddressSpace && file->getSize() - pixelDataOffset >= pixelDataSize)
+    {
+        if (progressHandler)
+            progressHandler(0);
+
+        // copied out rather than used in place: once the file is truncated or rewritten, as by saving over it,
+        // reading its unwritten pages would fault
+        bitmap.copyPixels(file->getData() + pixelDataOffset, header.width, header.height, pixelFormat, progressHandler);
+
+        if (progressHandler)
+            progressHandler(100);
+    }
+    else if (header.filetype == P2 || header.filetype == P3)
+    {
+        // P1 bits are packed, parallel chunks could share a byte, so it goes through the stream decoding
+        decodeAsciiPixels(bitmap, file->getData() + pixelDataOffset, file->getData() + file->getSize(), header, progressHandler);
+    }
+    else
+    {
+        RowReader reader(stream, header);
+        readRowsToBitmap(bitmap, reader, progressHandler);
+    }
+}
+
+BitmapHeader Parser::readHeader(std::istream &stream)
+{
+    BitmapHeader header;
     std::string pNumber;
-    FILETYPE filetype;
-    int maxValue;
-    int width;
-    int height;
-    long pixelCount;
-    char *rawInput = nullptr;
-    size_t bytesPerPixel = 0;
 
     pNumber = readStringSkipComment(stream);
-    width = readIntSkipComment(stream);
-    height = readIntSkipComment(stream);
-    maxValue = readIntSkipComment(stream);
-    consumeEmptyLines(stream);
 
-    pixelCount = width * height;
+    if (!(pNumber == "P1" || pNumber == "P2" || pNumber == "P3" || pNumber == "P4" || pNumber == "P5" || pNumber == "P6" || pNumber == "P7"))
+        throw unsupported_format_exception("This file format is not supported");
+
+    header.filetype = (FILETYPE)(pNumber[1] - '1');
+
+    if (header.filetype == P7)
+    {
+        readPamHeader(stream, header);
+    }
+    else
+    {
+        header.width = readIntSkipComment(stream);
+        header.height = readIntSkipComment(stream);
+        header.depth = header.filetype == P3 || header.filetype == P6 ? 3 : 1;
+
+        // bitmaps (P1 and P4) have no maxvalue, their pixels are either 0 (white) or 1 (black)
+        if (header.filetype == P1 || header.filetype == P4)
+            header.maxValue = 1;
+        else
+            header.maxValue = readIntSkipComment(stream);
+
+        consumeHeaderEnd(stream);
+    }
 
-    if (width < 1 || height < 1)
+    if (header.width < 1 || header.height < 1)
         throw bad_dimensions_exception("Width or height was less than 1");
-    if (pixelCount > MAX_PIXELS)
-        throw too_large_exception("Exceeded maximum supported pixel count");
 
-    if (pNumber == "P1" || pNumber == "P2" || pNumber == "P3" || pNumber == "P4" || pNumber == "P5" || pNumber == "P6")
+    // maxvalues up to 255 are stored in 8 bits (scaled to 255), larger ones in 16 bits
+    if (header.maxValue < 1 || header.maxValue > UINT16_MAX)
+        throw unsupported_maxvalue_exception("This bitmap's color maxvalue is not supported");
+
+    return header;
+}
+
+void Parser::readPamHeader(std::istream &stream, BitmapHeader &header)
+{
+    header.width = 0;
+    header.height = 0;
+    header.depth = 0;
+    header.maxValue = 0;
+
+    // one "KEY value" pair per line, until ENDHDR. Tuple types spanning several lines are joined with spaces.
+    for (std::string line = readStringSkipComment(stream); line != "ENDHDR"; line = readStringSkipComment(stream))
     {
-        filetype = (FILETYPE)(pNumber[1] - '1');
-
-        // only supports maxValue of 255 (8-bit) or 1 for P1
-        if (maxValue != 255 && maxValue != 1)
-            throw unsupported_maxvalue_exception("This bitmap's color maxvalue is not supported");
-
-        // Read all at once for binary files
-        if (filetype > P3) {
-          bytesPerPixel = (filetype == P6 ? 3 : 1);
-          rawInput = new char[pixelCount * bytesPerPixel];
-          stream.read(rawInput, pixelCount * bytesPerPixel);
-          throwExceptions(stream);
+        std::istringstream fields(line);
+        std::string key;
+
+        fields >> key;
+
+        if (key == "TUPLTYPE")
+        {
+            std::string tupleType;
+            std::getline(fields >> std::ws, tupleType);
+            header.tupleType += header.tupleType.empty() ? tupleType : " " + tupleType;
+            continue;
         }
 
-        bitmap.createBlank(width, height);
+        int *value = key == "WIDTH" ? &header.width : key == "HEIGHT" ? &header.height : key == "DEPTH" ? &header.depth : key == "MAXVAL" ? &header.maxValue : nullptr;
+
+        if (!value || !(fields >> *value))
+            throw stream_corrupt_exception("Failed to parse the PAM header", false);
+    }
+
+    // the tuple type is optional, the depth decides between gray and RGB with or without alpha
+    if (header.depth < 1 || header.depth > 4)
+        throw unsupported_format_exception("Only PAM images of 1 to 4 channels are supported");
+}
+
+PIXEL_FORMAT Parser::getPixelFormat(const BitmapHeader &header)
+{
+    if (header.filetype != P7)
+        return getPixelFormat(header.filetype, header.maxValue);
+
+    // black and white PAM stores 1 for white, a byte per pixel, so it is read into gray values
+    if (header.depth == 2)
+        return header.maxValue > 255 ? FORMAT_GRAY_ALPHA16 : FORMAT_GRAY_ALPHA;
+    if (header.depth == 3)
+        return header.maxValue > 255 ? FORMAT_RGB16 : FORMAT_RGB;
+    if (header.depth == 4)
+        return header.maxValue > 255 ? FORMAT_RGB_ALPHA16 : FORMAT_RGB_ALPHA;
+    return header.maxValue > 255 ? FORMAT_GRAY16 : FORMAT_GRAY;
+}
+
+PIXEL_FORMAT Parser::getPixelFormat(FILETYPE filetype, int maxValue)
+{
+    if (filetype == P1 || filetype == P4)
+        return FORMAT_BILEVEL;
+    if (filetype == P2 || filetype == P5)
+        return maxValue > 255 ? FORMAT_GRAY16 : FORMAT_GRAY;
+    return maxValue > 255 ? FORMAT_RGB16 : FORMAT_RGB;
+}
+
+void Parser::readRowsToBitmap(Bitmap &bitmap, RowReader &reader, std::function<void(int)> progressHandler)
+{
+    int width = reader.getWidth();
+    int height = reader.getHeight();
+
+    // grayscale and black and white files keep their narrower pixel format
+    bitmap.createBlank(width, height, Pixel(), reader.getPixelFormat(), reader.getHeader().maxValue);
+
+    // rows are decoded straight into the bitmap, in blocks of ~10000 pixels between progress updates
+    int rowsPerProgressUpdate = std::max(1, PROGRESS_BAR_UPDATE_TRESHOLD / width);
+
+    if (progressHandler)
+        progressHandler(0);
+
+    while (reader.hasMoreRows())
+    {
+        reader.readNativeRows(bitmap.getRowData(reader.getRowsRead()), rowsPerProgressUpdate);
 
         if (progressHandler)
-            progressHandler(0);
+            progressHandler(reader.getRowsRead() / (float)height * 100);
+    }
+}
+
+void Parser::decodeAsciiPixels(Bitmap &bitmap, const char *begin, const char *end, const BitmapHeader &header, std::function<void(int)> progressHandler)
+{
+    int width = header.width;
+    int height = header.height;
+    size_t valueCount = (size_t)width * height * (header.filetype == P3 ? 3 : 1);
+    WorkerPool &pool = WorkerPool::getInstance();
+
+    bitmap.createBlank(width, height, Pixel(), getPixelFormat(header), header.maxValue);
 
-        int pixelNum = 0;
-        for (int y = 0; y < height; y++)
+    uint8_t *pixels = bitmap.getRowData(0);
+    int chunkCount = (end - begin) >= PARALLEL_ASCII_MIN_BYTES ? pool.getWorkerCount() * ASCII_CHUNKS_PER_WORKER : 1;
+
+    // Chunks start at line beginnings, so they never start inside a comment or a value
+    std::vector<const char *> chunkStarts(chunkCount + 1);
+    chunkStarts[0] = begin;
+    chunkStarts[chunkCount] = end;
+
+    for (int chunk = 1; chunk < chunkCount; chunk++)
+    {
+        const char *start = std::max(begin + (end - begin) / chunkCount * chunk, chunkStarts[chunk - 1]);
+        const char *lineEnd = static_cast<const char *>(std::memchr(start, '\n', end - start));
+        chunkStarts[chunk] = lineEnd ? lineEnd + 1 : end;
+    }
+
+    // Index pass: count the values in each chunk, to know where each chunk's values go
+    std::vector<size_t> firstValues(chunkCount + 1, 0);
+
+    if (chunkCount > 1)
+    {
+        pool.forEachRowBand(chunkCount, [&](int firstChunk, int lastChunk) {
+            for (int chunk = firstChunk; chunk < lastChunk; chunk++)
+                firstValues[chunk + 1] = AsciiScanner(chunkStarts[chunk], chunkStarts[chunk + 1]).countValues(false);
+        });
+
+        for (int chunk = 0; chunk < chunkCount; chunk++)
+            firstValues[chunk + 1] += firstValues[chunk];
+    }
+    else
+    {
+        firstValues[1] = valueCount;
+    }
+
+    if (firstValues[chunkCount] < valueCount)
+        throw stream_corrupt_exception("Unexpectedly reached EOF while reading stream", true);
+
+    if (progressHandler)
+        progressHandler(0);
+
+    // Decoding pass: chunks are parsed in parallel, straight into the bitmap
+    std::atomic<size_t> decodedValues { 0 };
+
+    pool.forEachRowBand(chunkCount, [&](int firstChunk, int lastChunk) {
+        for (int chunk = firstChunk; chunk < lastChunk; chunk++)
         {
-            for (int x = 0; x < width; x++, pixelNum++)
-            {
-                // update progress event every 10000 pixels
-                if (progressHandler && pixelNum % PROGRESS_BAR_UPDATE_TRESHOLD == 0)
-                    progressHandler(pixelNum / (float)pixelCount * 100);
-
-                if (filetype == P6)
-                {
-                    bitmap.setPixelAtFast(x, y,
-                        Pixel(
-                            rawInput[pixelNum * bytesPerPixel],
-                            rawInput[pixelNum * bytesPerPixel + 1],
-                            rawInput[pixelNum * bytesPerPixel + 2]
-                        )
-                    );
-                }
-                else if (filetype == P5)
-                {
-                    uint8_t value = rawInput[pixelNum * bytesPerPixel];
-
-                    bitmap.setPixelAtFast(x, y, Pixel(value, value, value));
-                }
-                else if (filetype == P4)
-                {
-                    uint8_t value = rawInput[pixelNum * bytesPerPixel] == 1 ? 255 : 0;
-                    bitmap.setPixelAtFast(x, y, Pixel(value, value, value));
-                }
-                else
-                {
-                    bitmap.setPixelAtFast(x, y, readPixel(stream, filetype));
-                }
-            }
+            size_t firstValue = std::min(firstValues[chunk], valueCount);
+            size_t lastValue = std::min(firstValues[chunk + 1], valueCount);
+            AsciiScanner scanner(chunkStarts[chunk], chunkStarts[chunk + 1]);
+
+            decodedValues += decodeAsciiValues(scanner, pixels, firstValue, lastValue, header);
         }
+    }, progressHandler);
 
-        if (progressHandler)
-            progressHandler(100);
-        if (rawInput)
-            delete[] rawInput;
-        rawInput = nullptr;
+    if (decodedValues != valueCount)
+        throw stream_corrupt_exception("Unexpectedly reached EOF while reading stream", true);
+
+    if (progressHandler)
+        progressHandler(100);
+}
+
+size_t Parser::decodeAsciiValues(AsciiScanner &scanner, uint8_t *destination, size_t firstValue, size_t lastValue, const BitmapHeader &header)
+{
+    unsigned value;
+    unsigned maxValue = header.maxValue;
+    size_t index = firstValue;
+
+    if (maxValue == 255)
+    {
+        // values map 1:1 onto the bytes of RGB and gray rows
+        while (index < lastValue && scanner.readValue(value))
+        {
+            if (value > maxValue)
+                throw stream_corrupt_exception("Pixel value exceeds the maxvalue");
+            destination[index++] = value;
+        }
+    }
+    else if (maxValue > 255)
+    {
+        // and onto the channels of 16-bit rows
+        uint16_t *channels = reinterpret_cast<uint16_t *>(destination);
+
+        while (index < lastValue && scanner.readValue(value))
+        {
+            if (value > maxValue)
+                throw stream_corrupt_exception("Pixel value exceeds the maxvalue");
+            channels[index++] = value;
+        }
+    }
+    else if (header.filetype != P1)
+    {
+        // smaller maxvalues are scaled up to 255
+        while (index < lastValue && scanner.readValue(value))
+        {
+            if (value > maxValue)
+                throw stream_corrupt_exception("Pixel value exceeds the maxvalue");
+            destination[index++] = (value * 255 + maxValue / 2) / maxValue;
+        }
     }
     else
     {
-        throw unsupported_format_exception("This file format is not supported");
+        // bits are packed into bilevel rows, padded to whole bytes
+        size_t rowSize = PixelFormats::getRowSize(header.width, FORMAT_BILEVEL);
+        size_t y = firstValue / header.width;
+        int x = firstValue % header.width;
+
+        while (index < lastValue && scanner.readBit(value))
+        {
+            uint8_t &byte = destination[y * rowSize + x / 8];
+            uint8_t mask = 0x80 >> (x % 8);
+
+            byte = value == 1 ? byte | mask : byte & ~mask;
+            index++;
+
+            if (++x == header.width)
+            {
+                x = 0;
+                y++;
+            }
+        }
     }
+
+    return index - firstValue;
 }
 
-void Parser::saveBitmapTo(Bitmap &bitmap, std::ostream &stream, FILETYPE filetype, std::function<void(int)> progressHandler)
+void Parser::saveBitmapTo(Bitmap &bitmap, std::ostream &stream, FILETYPE filetype, std::function<void(int)> progressHandler, int valuesPerLine)
 {
     if (!bitmap.hasOpenBitmap())
         throw no_bitmap_open_exception("No bitmap was open when trying to save");
-    if (filetype == P3 || filetype == P6)
-    {
-        int width = bitmap.getWidth();
-        int height = bitmap.getHeight();
-        long pixelCount = width * height;
 
-        int pNumber = (filetype - P1) + 1;
+    int width = bitmap.getWidth();
+    int height = bitmap.getHeight();
+
+    // 16-bit images keep their depth, unless saved as a bitmap. PAM keeps the pixel format as well.
+    PIXEL_FORMAT bitmapFormat = bitmap.getPixelFormat();
+    int maxValue = PixelFormats::isDeep(bitmapFormat) && filetype != P1 && filetype != P4 ? bitmap.getMaxValue() : 255;
 
-        if (pixelCount > MAX_PIXELS)
-            throw too_large_exception("Bitmap's pixel count too large");
+    RowWriter writer(stream, filetype, width, height, maxValue, bitmapFormat);
+    PIXEL_FORMAT fileFormat = writer.getPixelFormat();
 
+    if (valuesPerLine > 0)
+        writer.setValuesPerLine(valuesPerLine);
+
+    // large blocks, so the ASCII formatting is spread over the worker pool
+    int blockRows = RowStream::getBlockRows(width);
+    size_t rowSize = PixelFormats::getRowSize(width, fileFormat);
+
+    // rows of another format are converted a block at a time
+    std::vector<uint8_t> block;
+    if (bitmapFormat != fileFormat)
+        block.resize(rowSize * blockRows);
+
+    if (progressHandler)
+        progressHandler(0);
+
+    for (int y = 0; y < height; y += blockRows)
+    {
         if (progressHandler)
-            progressHandler(0);
+            progressHandler(y / (float)height * 100);
 
-        stream
-            << "P" << pNumber << '\n'
-            << "# Created with PamView" << '\n'
-            << width << ' ' << height << '\n'
-            << 255 << '\n';
+        int rowCount = std::min(blockRows, height - y);
 
-        int pixelNum = 0;
-        for (int y = 0; y < height; y++)
+        if (block.empty())
         {
-            for (int x = 0; x < width; x++, pixelNum++)
-            {
-                // update progress event every 10000 pixels
-                if (progressHandler && pixelNum % PROGRESS_BAR_UPDATE_TRESHOLD == 0)
-                    progressHandler(pixelNum / (float)pixelCount * 100);
-
-                Pixel pixel = bitmap.getPixelAtFast(x, y);
-
-                if (filetype == P3) {
-                  stream << (int)pixel.r << '\n'
-                         << (int)pixel.g << '\n'
-                         << (int)pixel.b << '\n';
-                } else if (filetype == P6) {
-                  stream << pixel.r << pixel.g << pixel.b;
-                }
-            }
+            writer.writeNativeRows(bitmap.getRowData(y), rowCount);
         }
+        else
+        {
+            for (int row = 0; row < rowCount; row++)
+                PixelFormats::convertRow(bitmap.getRowData(y + row), bitmapFormat, block.data() + row * rowSize, fileFormat, width, bitmap.getMaxValue());
 
-        if (progressHandler)
-            progressHandler(100);
+            writer.writeNativeRows(block.data(), rowCount);
+        }
     }
-    else
-        throw unsupported_format_exception("This format is not supported for saving");
+
+    if (progressHandler)
+        progressHandler(100);
 }
 
 std::string Parser::readStringSkipComment(std::istream &stream)
@@ -189,61 +431,6 @@ int Parser::readIntSkipComment(std::istream &stream)
     return num;
 }
 
-char Parser::readRawChar(std::istream &stream)
-{
-    char value;
-    stream.read(&value, 1);
-    throwExceptions(stream);
-    return value;
-}
-
-Pixel Parser::readPixel(std::istream &stream, FILETYPE filetype)
-{
-    uint8_t r, g, b;
-
-    if (filetype == P6)
-    {
-        r = readRawChar(stream);
-        g = readRawChar(stream);
-        b = readRawChar(stream);
-    }
-    else if (filetype == P3)
-    {
-        int ir, ig, ib;
-
-        stream >> ir;
-        stream >> ig;
-        stream >> ib;
-
-        r = ir;
-        g = ig;
-        b = ib;
-    }
-    else if (filetype == P5)
-    {
-        r = g = b = stream.get();
-    }
-    else if (filetype == P2)
-    {
-        int value;
-        stream >> value;
-        r = g = b = (uint8_t)value;
-    }
-    else if (filetype == P4)
-    {
-        uint8_t value = (readRawChar(stream) == 1 ? 255 : 0);
-        r = g = b = value;
-    }
-    else if (filetype == P1)
-    {
-        int value;
-        stream >> value;
-        r = g = b = (value == 1 ? 255 : 0);
-    }
-
-    return Pixel(r, g, b);
-}
-
 void Parser::throwExceptions(std::istream &stream)
 {
     if (stream.eof())
@@ -259,3 +446,10 @@ void Parser::consumeEmptyLines(std::istream &stream)
     while (stream.peek() == '\n' || stream.peek() == '\r')
         stream.get();
 }
+
+void Parser::consumeHeaderEnd(std::istream &stream)
+{
+    // exactly one whitespace character ends the header, raw pixel data may start with bytes looking like whitespace
+    if (std::isspace(stream.peek()))
+        stream.get();
+}
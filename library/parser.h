@@ -1,18 +1,56 @@
 #pragma once
+#include "asciiscanner.h"
 #include "bitmap.h"
 #include <cstdint>
+#include <string>
+
+class RowReader;
+
+// Describes the image stored in a PNM stream, as read from its header.
+struct BitmapHeader
+{
+    FILETYPE filetype = P3;
+    int width = 0;
+    int height = 0;
+    // Channels per pixel, 1 for gray and bilevel files, 3 for RGB ones, up to 4 for PAM
+    int depth = 3;
+    int maxValue = 255;
+    // The TUPLTYPE of PAM files, empty for the others
+    std::string tupleType;
+};
 
 class Parser
 {
 public:
     static void loadToBitmap(Bitmap &bitmap, std::istream &stream, std::function<void(int)> progressHandler = nullptr);
-    static void saveBitmapTo(Bitmap &bitmap, std::ostream &stream, FILETYPE filetype, std::function<void(int)> progressHandler = nullptr);
+    // Maps the file into memory and parses it in place. Raw rows stored like the bitmap rows are copied straight from the mapping.
+    // The file is only mapped while loading, so it may be saved over or changed afterwards.
+    static void loadFromFile(Bitmap &bitmap, const std::string &path, std::function<void(int)> progressHandler = nullptr);
+    // Writes the bitmap in given filetype. ASCII values go valuesPerLine to a line (see RowWriter::setValuesPerLine), 0 keeps the default.
+    static void saveBitmapTo(Bitmap &bitmap, std::ostream &stream, FILETYPE filetype, std::function<void(int)> progressHandler = nullptr, int valuesPerLine = 0);
+
+    // Reads and validates the header, leaving the stream at the first byte of pixel data.
+    static BitmapHeader readHeader(std::istream &stream);
+
+    // Returns the pixel format holding the images of given filetype and maxvalue without loss.
+    // PAM (P7) files need their depth as well, see the header version.
+    static PIXEL_FORMAT getPixelFormat(FILETYPE filetype, int maxValue = 255);
+
+    // Returns the pixel format holding the images described by header without loss.
+    static PIXEL_FORMAT getPixelFormat(const BitmapHeader &header);
+
+    // Decodes the ASCII values with indices [firstValue, lastValue) of the pixel data into destination, which starts at value 0
+    // and is stored in the pixel format of the filetype and maxvalue. Bilevel rows are packed, so chunks decoded at once must not share a byte.
+    // Returns the number of values decoded, which is less than requested if the scanner ran out of data.
+    static size_t decodeAsciiValues(AsciiScanner &scanner, uint8_t *destination, size_t firstValue, size_t lastValue, const BitmapHeader &header);
 
 private:
+    static void readRowsToBitmap(Bitmap &bitmap, RowReader &reader, std::function<void(int)> progressHandler);
+    static void decodeAsciiPixels(Bitmap &bitmap, const char *begin, const char *end, const BitmapHeader &header, std::function<void(int)> progressHandler);
+    static void readPamHeader(std::istream &stream, BitmapHeader &header);
     static std::string readStringSkipComment(std::istream &stream);
     static int readIntSkipComment(std::istream &stream);
-    static char readRawChar(std::istream &stream);
-    static Pixel readPixel(std::istream &stream, FILETYPE filetype);
     static void throwExceptions(std::istream &stream);
     static void consumeEmptyLines(std::istream &stream);
+    static void consumeHeaderEnd(std::istream &stream);
 };
\ No newline at end of file
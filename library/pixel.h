@@ -7,12 +7,18 @@ class Pixel {
         uint8_t r;
         uint8_t g;
         uint8_t b;
-        Pixel(uint8_t r, uint8_t g, uint8_t b);
+        Pixel(uint8_t red, uint8_t green, uint8_t blue) : r(red), g(green), b(blue) {}
         // Creates a default white pixel
-        Pixel();
+        Pixel() : Pixel(255, 255, 255) {}
 
         // Gets the grayscale value of this pixel (R, G, and B are equal in grayscale).
-        uint8_t getGrayscaleValue();
+        uint8_t getGrayscaleValue() const { return (r + g + b) / 3; }
+
+        // Gets the perceived brightness of this pixel, 0.3R + 0.587G + 0.114B rounded down, as the black and white transformation computes it.
+        uint8_t getLuminance() const { return 0.3 * r + 0.587 * g + 0.114 * b; }
 
         friend std::ostream &operator<<(std::ostream &stream, const Pixel &pixel);
-};
\ No newline at end of file
+};
+
+// Pixels are packed RGB triplets, so a row of pixels has the same layout as a row of raw PPM (P6) data.
+static_assert(sizeof(Pixel) == 3, "Pixel must be a packed RGB triplet");
\ No newline at end of file
@@ -0,0 +1,257 @@
+#include "pixelformat.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace {
+    // The 8 pixels encoded by every bilevel byte, so expanding a byte is a single copy
+    struct BitExpansionTable
+    {
+        Pixel pixels[256][8];
+
+        BitExpansionTable()
+        {
+            for (int byte = 0; byte < 256; byte++)
+            {
+                for (int bit = 0; bit < 8; bit++)
+                {
+                    uint8_t value = (byte << bit) & 0x80 ? 0 : 255;
+                    pixels[byte][bit] = Pixel(value, value, value);
+                }
+            }
+        }
+    };
+
+    const BitExpansionTable bitExpansionTable;
+
+    // Stores the colors of RGB pixels into rows of gray or RGB channels, optionally followed by alpha which is kept.
+    template <typename Channel, typename Scale>
+    void storeColors(const Pixel *source, Channel *destination, int channels, int width, Scale scale)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            Channel *pixel = destination + (size_t)x * channels;
+
+            if (channels < 3)
+            {
+                pixel[0] = scale(source[x].getGrayscaleValue());
+            }
+            else
+            {
+                pixel[0] = scale(source[x].r);
+                pixel[1] = scale(source[x].g);
+                pixel[2] = scale(source[x].b);
+            }
+        }
+    }
+
+    // Sets the alpha channel, the last one of every pixel, to given value.
+    template <typename Channel>
+    void fillAlpha(Channel *row, int channels, int width, Channel value)
+    {
+        for (int x = 0; x < width; x++)
+            row[(size_t)x * channels + channels - 1] = value;
+    }
+
+    // Converts between rows of gray or RGB channels of the same depth, either with or without alpha.
+    // Pixels without alpha get opaque ones.
+    template <typename Channel>
+    void convertChannels(const Channel *source, int sourceChannels, Channel *destination, int destinationChannels, int width, Channel opaque)
+    {
+        bool sourceAlpha = sourceChannels % 2 == 0;
+        bool destinationAlpha = destinationChannels % 2 == 0;
+
+        for (int x = 0; x < width; x++)
+        {
+            const Channel *in = source + x * sourceChannels;
+            Channel *out = destination + x * destinationChannels;
+
+            if (destinationChannels < 3)
+            {
+                out[0] = sourceChannels < 3 ? in[0] : ((unsigned)in[0] + in[1] + in[2]) / 3;
+            }
+            else if (sourceChannels < 3)
+            {
+                out[0] = out[1] = out[2] = in[0];
+            }
+            else
+            {
+                out[0] = in[0];
+                out[1] = in[1];
+                out[2] = in[2];
+            }
+
+            if (destinationAlpha)
+                out[destinationChannels - 1] = sourceAlpha ? in[sourceChannels - 1] : opaque;
+        }
+    }
+}
+
+namespace PixelFormats {
+    size_t getRowSize(int width, PIXEL_FORMAT format)
+    {
+        if (format == FORMAT_BILEVEL)
+            return (width + 7) / 8;
+
+        return (size_t)width * getChannelCount(format) * (isDeep(format) ? sizeof(uint16_t) : sizeof(uint8_t));
+    }
+
+    PIXEL_FORMAT getColorFormat(PIXEL_FORMAT format)
+    {
+        switch (format)
+        {
+        case FORMAT_GRAY:
+        case FORMAT_BILEVEL:
+            return FORMAT_RGB;
+        case FORMAT_GRAY16:
+            return FORMAT_RGB16;
+        case FORMAT_GRAY_ALPHA:
+            return FORMAT_RGB_ALPHA;
+        case FORMAT_GRAY_ALPHA16:
+            return FORMAT_RGB_ALPHA16;
+        default:
+            return format;
+        }
+    }
+
+    PIXEL_FORMAT getShallowFormat(PIXEL_FORMAT format)
+    {
+        switch (format)
+        {
+        case FORMAT_RGB16:
+            return FORMAT_RGB;
+        case FORMAT_GRAY16:
+            return FORMAT_GRAY;
+        case FORMAT_RGB_ALPHA16:
+            return FORMAT_RGB_ALPHA;
+        case FORMAT_GRAY_ALPHA16:
+            return FORMAT_GRAY_ALPHA;
+        default:
+            return format;
+        }
+    }
+
+    PIXEL_FORMAT getDeepFormat(PIXEL_FORMAT format)
+    {
+        switch (format)
+        {
+        case FORMAT_RGB:
+            return FORMAT_RGB16;
+        case FORMAT_GRAY:
+        case FORMAT_BILEVEL:
+            return FORMAT_GRAY16;
+        case FORMAT_RGB_ALPHA:
+            return FORMAT_RGB_ALPHA16;
+        case FORMAT_GRAY_ALPHA:
+            return FORMAT_GRAY_ALPHA16;
+        default:
+            return format;
+        }
+    }
+
+    bool canRepresent(Pixel pixel, PIXEL_FORMAT format)
+    {
+        bool isGrayPixel = pixel.r == pixel.g && pixel.g == pixel.b;
+
+        if (format == FORMAT_BILEVEL)
+            return isGrayPixel && (pixel.r == 0 || pixel.r == 255);
+
+        return isGrayPixel || !isGray(format);
+    }
+
+    void toPixels(const uint8_t *source, PIXEL_FORMAT format, Pixel *destination, int width, unsigned maxValue)
+    {
+        switch (format)
+        {
+        case FORMAT_RGB:
+            std::memcpy(destination, source, (size_t)width * sizeof(Pixel));
+            break;
+        case FORMAT_GRAY:
+            for (int x = 0; x < width; x++)
+                destination[x] = Pixel(source[x], source[x], source[x]);
+            break;
+        case FORMAT_BILEVEL:
+            for (int x = 0; x < width; x += 8)
+                std::memcpy(destination + x, bitExpansionTable.pixels[source[x / 8]], std::min(8, width - x) * sizeof(Pixel));
+            break;
+        default:
+            for (int x = 0; x < width; x++)
+                destination[x] = getPixel(source, format, x, maxValue);
+        }
+    }
+
+    void fromPixels(const Pixel *source, uint8_t *destination, PIXEL_FORMAT format, int width, unsigned maxValue)
+    {
+        setColors(source, destination, format, width, maxValue);
+
+        if (!hasAlpha(format))
+            return;
+
+        if (isDeep(format))
+            fillAlpha(reinterpret_cast<uint16_t *>(destination), getChannelCount(format), width, (uint16_t)maxValue);
+        else
+            fillAlpha(destination, getChannelCount(format), width, (uint8_t)255);
+    }
+
+    void setColors(const Pixel *source, uint8_t *destination, PIXEL_FORMAT format, int width, unsigned maxValue)
+    {
+        switch (format)
+        {
+        case FORMAT_RGB:
+            std::memcpy(destination, source, (size_t)width * sizeof(Pixel));
+            break;
+        case FORMAT_GRAY:
+            for (int x = 0; x < width; x++)
+                destination[x] = source[x].getGrayscaleValue();
+            break;
+        case FORMAT_BILEVEL:
+            // the padding bits of the last byte are left at 0
+            std::memset(destination, 0, getRowSize(width, format));
+            for (int x = 0; x < width; x++)
+                destination[x / 8] |= (source[x].getLuminance() > 127 ? 0 : 1) << (7 - x % 8);
+            break;
+        default:
+            if (isDeep(format))
+                storeColors(source, reinterpret_cast<uint16_t *>(destination), getChannelCount(format), width, [maxValue](uint8_t value) { return fromByte(value, maxValue); });
+            else
+                storeColors(source, destination, getChannelCount(format), width, [](uint8_t value) { return value; });
+        }
+    }
+
+    void convertRow(const uint8_t *source, PIXEL_FORMAT sourceFormat, uint8_t *destination, PIXEL_FORMAT destinationFormat, int width, unsigned maxValue)
+    {
+        int sourceChannels = getChannelCount(sourceFormat);
+        int destinationChannels = getChannelCount(destinationFormat);
+
+        if (sourceFormat == destinationFormat)
+        {
+            std::memcpy(destination, source, getRowSize(width, sourceFormat));
+        }
+        else if (isDeep(sourceFormat) && isDeep(destinationFormat))
+        {
+            convertChannels(reinterpret_cast<const uint16_t *>(source), sourceChannels, reinterpret_cast<uint16_t *>(destination), destinationChannels, width, (uint16_t)maxValue);
+        }
+        else if (!isDeep(sourceFormat) && !isDeep(destinationFormat) && sourceFormat != FORMAT_BILEVEL && destinationFormat != FORMAT_BILEVEL)
+        {
+            convertChannels(source, sourceChannels, destination, destinationChannels, width, (uint8_t)255);
+        }
+        else
+        {
+            std::vector<Pixel> pixels(width);
+            toPixels(source, sourceFormat, pixels.data(), width, maxValue);
+            fromPixels(pixels.data(), destination, destinationFormat, width, maxValue);
+
+            // the depth changes, so does the scale of the alpha
+            if (hasAlpha(sourceFormat) && hasAlpha(destinationFormat))
+            {
+                for (int x = 0; x < width; x++)
+                {
+                    if (isDeep(sourceFormat))
+                        destination[x * destinationChannels + destinationChannels - 1] = toByte(reinterpret_cast<const uint16_t *>(source)[x * sourceChannels + sourceChannels - 1], maxValue);
+                    else
+                        reinterpret_cast<uint16_t *>(destination)[x * destinationChannels + destinationChannels - 1] = fromByte(source[x * sourceChannels + sourceChannels - 1], maxValue);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,175 @@
+#pragma once
+#include "pixel.h"
+#include <cstddef>
+#include <cstdint>
+
+// Represents how the pixels of a bitmap are stored in memory
+enum PIXEL_FORMAT
+{
+    // 3 bytes per pixel, red, green and blue (like raw PPM rows)
+    FORMAT_RGB,
+    // 1 byte per pixel, the gray value (like raw PGM rows)
+    FORMAT_GRAY,
+    // 1 bit per pixel, 8 pixels per byte with the most significant bit first, 1 being black (like raw PBM rows)
+    FORMAT_BILEVEL,
+    // 3 16-bit channels per pixel, in the host byte order, holding values up to the bitmap maxvalue
+    FORMAT_RGB16,
+    // 1 16-bit gray value per pixel, in the host byte order, holding values up to the bitmap maxvalue
+    FORMAT_GRAY16,
+    // 4 bytes per pixel, red, green, blue and opacity (like raw PAM RGB_ALPHA rows)
+    FORMAT_RGB_ALPHA,
+    // 2 bytes per pixel, the gray value and opacity (like raw PAM GRAYSCALE_ALPHA rows)
+    FORMAT_GRAY_ALPHA,
+    // 4 16-bit channels per pixel, like FORMAT_RGB16 followed by the opacity
+    FORMAT_RGB_ALPHA16,
+    // 2 16-bit channels per pixel, like FORMAT_GRAY16 followed by the opacity
+    FORMAT_GRAY_ALPHA16
+};
+
+// Conversions between rows stored in any pixel format and rows of RGB pixels.
+// Pixels are 8-bit, so 16-bit channels are scaled between 0-255 and 0-maxValue. Pixels have no alpha, so
+// it is dropped when reading rows, and pixels written into a format with alpha are opaque.
+namespace PixelFormats {
+    // Returns the number of bytes taken by a row of given width. Bilevel rows are padded to whole bytes.
+    size_t getRowSize(int width, PIXEL_FORMAT format);
+
+    // Returns the number of channels of a pixel, alpha included. Bilevel pixels have 1.
+    inline int getChannelCount(PIXEL_FORMAT format)
+    {
+        switch (format)
+        {
+        case FORMAT_RGB:
+        case FORMAT_RGB16:
+            return 3;
+        case FORMAT_RGB_ALPHA:
+        case FORMAT_RGB_ALPHA16:
+            return 4;
+        case FORMAT_GRAY_ALPHA:
+        case FORMAT_GRAY_ALPHA16:
+            return 2;
+        default:
+            return 1;
+        }
+    }
+
+    // Returns if the format stores 16-bit channels.
+    inline bool isDeep(PIXEL_FORMAT format)
+    {
+        return format == FORMAT_RGB16 || format == FORMAT_GRAY16 || format == FORMAT_RGB_ALPHA16 || format == FORMAT_GRAY_ALPHA16;
+    }
+
+    // Returns if the format stores an alpha channel, after the color channels of each pixel.
+    inline bool hasAlpha(PIXEL_FORMAT format)
+    {
+        return getChannelCount(format) % 2 == 0;
+    }
+
+    // Returns if the pixels of the format are always gray.
+    inline bool isGray(PIXEL_FORMAT format)
+    {
+        return getChannelCount(format) < 3;
+    }
+
+    // Returns the format of the same depth and alpha able to hold colors.
+    PIXEL_FORMAT getColorFormat(PIXEL_FORMAT format);
+
+    // Returns the 8-bit format with the same channels, bilevel for bilevel.
+    PIXEL_FORMAT getShallowFormat(PIXEL_FORMAT format);
+
+    // Returns the 16-bit format with the same channels, 16-bit gray for bilevel.
+    PIXEL_FORMAT getDeepFormat(PIXEL_FORMAT format);
+
+    // Returns if the pixel can be stored in given format without losing anything.
+    bool canRepresent(Pixel pixel, PIXEL_FORMAT format);
+
+    // Expands a row stored in given format into RGB pixels.
+    void toPixels(const uint8_t *source, PIXEL_FORMAT format, Pixel *destination, int width, unsigned maxValue = 255);
+
+    // Stores a row of RGB pixels in given format. Gray uses the pixel gray value,
+    // bilevel the treshold of the black and white transformation.
+    void fromPixels(const Pixel *source, uint8_t *destination, PIXEL_FORMAT format, int width, unsigned maxValue = 255);
+
+    // Stores the colors of a row of RGB pixels like fromPixels, keeping the alpha already in destination.
+    void setColors(const Pixel *source, uint8_t *destination, PIXEL_FORMAT format, int width, unsigned maxValue = 255);
+
+    // Converts a row between two formats. Deep rows of both formats use the same maxValue, formats of the same depth
+    // are converted directly, the others through 8-bit pixels. Alpha is kept if both formats have it.
+    void convertRow(const uint8_t *source, PIXEL_FORMAT sourceFormat, uint8_t *destination, PIXEL_FORMAT destinationFormat, int width, unsigned maxValue = 255);
+
+    // Scales a 16-bit value up to maxValue into 8 bits, and back.
+    inline uint8_t toByte(unsigned value, unsigned maxValue) { return (value * 255 + maxValue / 2) / maxValue; }
+    inline uint16_t fromByte(uint8_t value, unsigned maxValue) { return (value * maxValue + 127) / 255; }
+
+    // Returns the pixel at given position of a row stored in given format.
+    inline Pixel getPixel(const uint8_t *row, PIXEL_FORMAT format, int x, unsigned maxValue = 255)
+    {
+        if (format == FORMAT_BILEVEL)
+        {
+            uint8_t value = (row[x / 8] << (x % 8)) & 0x80 ? 0 : 255;
+            return Pixel(value, value, value);
+        }
+
+        int channels = getChannelCount(format);
+        int green = isGray(format) ? 0 : 1;
+        int blue = isGray(format) ? 0 : 2;
+
+        if (isDeep(format))
+        {
+            const uint16_t *pixel = reinterpret_cast<const uint16_t *>(row) + (size_t)x * channels;
+            return Pixel(toByte(pixel[0], maxValue), toByte(pixel[green], maxValue), toByte(pixel[blue], maxValue));
+        }
+
+        const uint8_t *pixel = row + (size_t)x * channels;
+        return Pixel(pixel[0], pixel[green], pixel[blue]);
+    }
+
+    // Stores the pixel at given position of a row stored in given format, as opaque in the formats with alpha.
+    inline void setPixel(uint8_t *row, PIXEL_FORMAT format, int x, Pixel pixel, unsigned maxValue = 255)
+    {
+        if (format == FORMAT_BILEVEL)
+        {
+            if (pixel.getLuminance() > 127)
+                row[x / 8] &= ~(0x80 >> (x % 8));
+            else
+                row[x / 8] |= 0x80 >> (x % 8);
+            return;
+        }
+
+        int channels = getChannelCount(format);
+
+        if (isDeep(format))
+        {
+            uint16_t *values = reinterpret_cast<uint16_t *>(row) + (size_t)x * channels;
+
+            if (isGray(format))
+            {
+                values[0] = fromByte(pixel.getGrayscaleValue(), maxValue);
+            }
+            else
+            {
+                values[0] = fromByte(pixel.r, maxValue);
+                values[1] = fromByte(pixel.g, maxValue);
+                values[2] = fromByte(pixel.b, maxValue);
+            }
+            if (hasAlpha(format))
+                values[channels - 1] = maxValue;
+        }
+        else
+        {
+            uint8_t *values = row + (size_t)x * channels;
+
+            if (isGray(format))
+            {
+                values[0] = pixel.getGrayscaleValue();
+            }
+            else
+            {
+                values[0] = pixel.r;
+                values[1] = pixel.g;
+                values[2] = pixel.b;
+            }
+            if (hasAlpha(format))
+                values[channels - 1] = 255;
+        }
+    }
+}
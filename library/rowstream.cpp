@@ -0,0 +1,379 @@
+#include "rowstream.h"
+#include "channelkernels.h"
+#include "exceptions.h"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#define STREAM_BLOCK_PIXELS (1 << 18)
+#define ASCII_VALUES_PER_LINE 15
+#define ASCII_MAX_LINE_LENGTH 70
+#define ASCII_CHUNK_VALUES (1 << 16)
+
+namespace {
+    // Decimal representation of every 8-bit value, so formatting a value is a single copy
+    struct DecimalDigits
+    {
+        char digits[3];
+        uint8_t length;
+    };
+
+    struct DecimalTable
+    {
+        DecimalDigits values[256];
+
+        DecimalTable()
+        {
+            for (int value = 0; value < 256; value++)
+            {
+                DecimalDigits &entry = values[value];
+                entry.length = value >= 100 ? 3 : value >= 10 ? 2 : 1;
+
+                for (int digit = entry.length - 1, rest = value; digit >= 0; digit--, rest /= 10)
+                    entry.digits[digit] = '0' + rest % 10;
+            }
+        }
+    };
+
+    const DecimalTable decimalTable;
+
+    int getValuesPerPixel(FILETYPE filetype)
+    {
+        return filetype == P3 || filetype == P6 ? 3 : 1;
+    }
+}
+
+RowReader::RowReader(std::istream &stream) : RowReader(stream, Parser::readHeader(stream))
+{
+}
+
+RowReader::RowReader(std::istream &stream, const BitmapHeader &header)
+    : stream(stream), header(header), pixelFormat(Parser::getPixelFormat(header))
+{
+    if (header.filetype <= P3)
+        scanner = std::make_unique<AsciiScanner>(stream);
+    if (pixelFormat != FORMAT_RGB)
+        rowInput.resize(PixelFormats::getRowSize(header.width, pixelFormat));
+}
+
+int RowReader::readRows(Pixel *destination, int rowCount)
+{
+    if (pixelFormat == FORMAT_RGB)
+        return readNativeRows(reinterpret_cast<uint8_t *>(destination), rowCount);
+
+    // single channel rows are expanded into RGB one at a time
+    for (int y = 0; y < rowCount; y++)
+    {
+        if (readNativeRows(rowInput.data(), 1) == 0)
+            return y;
+
+        PixelFormats::toPixels(rowInput.data(), pixelFormat, destination + (size_t)y * header.width, header.width, header.maxValue);
+    }
+
+    return rowCount;
+}
+
+int RowReader::readNativeRows(uint8_t *destination, int rowCount)
+{
+    rowCount = std::min(rowCount, header.height - rowsRead);
+
+    if (rowCount <= 0)
+        return 0;
+
+    if (scanner)
+    {
+        size_t valueCount = (size_t)header.width * rowCount * (header.filetype == P3 ? 3 : 1);
+
+        if (Parser::decodeAsciiValues(*scanner, destination, 0, valueCount, header) != valueCount)
+            throw stream_corrupt_exception("Unexpectedly reached EOF while reading stream", true);
+    }
+    else
+    {
+        // raw rows are stored exactly like the rows of the matching pixel format, so read them in place
+        size_t size = PixelFormats::getRowSize(header.width, pixelFormat) * rowCount;
+
+        stream.read(reinterpret_cast<char *>(destination), (std::streamsize)size);
+        if (!stream)
+            throw stream_corrupt_exception("Unexpectedly reached EOF while reading stream", true);
+
+        if (PixelFormats::isDeep(pixelFormat))
+        {
+            // 16-bit values are big-endian in the file
+            ChannelKernels::fromBigEndian(reinterpret_cast<uint16_t *>(destination), size / 2, header.maxValue);
+        }
+        else if (header.maxValue < 255 && pixelFormat != FORMAT_BILEVEL)
+        {
+            // smaller maxvalues are scaled up to 255, out of range values are clamped
+            uint8_t scale[256];
+            for (int value = 0; value < 256; value++)
+                scale[value] = (std::min(value, header.maxValue) * 255 + header.maxValue / 2) / header.maxValue;
+
+            for (size_t i = 0; i < size; i++)
+                destination[i] = scale[destination[i]];
+        }
+    }
+
+    rowsRead += rowCount;
+    return rowCount;
+}
+
+RowWriter::RowWriter(std::ostream &stream, FILETYPE filetype, int width, int height, int maxValue, PIXEL_FORMAT tupleFormat)
+    : stream(stream), filetype(filetype), width(width), height(height), maxValue(maxValue)
+{
+    if (filetype < P1 || filetype > P7)
+        throw unsupported_format_exception("This format is not supported for saving");
+    if (width < 1 || height < 1)
+        throw bad_dimensions_exception("Width or height was less than 1");
+
+    // bitmaps have no maxvalue, the others are either 8-bit or 16-bit
+    if (filetype == P1 || filetype == P4)
+        this->maxValue = 1;
+    else if (maxValue < 255 || maxValue > UINT16_MAX)
+        throw unsupported_maxvalue_exception("Only 8-bit and 16-bit maxvalues are supported for saving");
+
+    if (filetype == P7)
+    {
+        // bilevel rows are written as gray, the alpha and depth follow the maxvalue
+        PIXEL_FORMAT format = tupleFormat == FORMAT_BILEVEL ? FORMAT_GRAY : tupleFormat;
+        pixelFormat = maxValue > 255 ? PixelFormats::getDeepFormat(format) : PixelFormats::getShallowFormat(format);
+    }
+    else
+    {
+        pixelFormat = Parser::getPixelFormat(filetype, this->maxValue);
+    }
+
+    // whole pixels per line for PPM, as many values as fit for the single channel formats
+    valuesPerLine = filetype == P3 ? std::min(ASCII_VALUES_PER_LINE, getMaxValuesPerLine() / 3 * 3) : getMaxValuesPerLine();
+
+    int pNumber = (filetype - P1) + 1;
+
+    stream
+        << "P" << pNumber << '\n'
+        << "# Created with PamView" << '\n';
+
+    if (filetype == P7)
+    {
+        const char *tupleType = PixelFormats::isGray(pixelFormat) ? "GRAYSCALE" : "RGB";
+
+        stream
+            << "WIDTH " << width << '\n'
+            << "HEIGHT " << height << '\n'
+            << "DEPTH " << PixelFormats::getChannelCount(pixelFormat) << '\n'
+            << "MAXVAL " << maxValue << '\n'
+            << "TUPLTYPE " << tupleType << (PixelFormats::hasAlpha(pixelFormat) ? "_ALPHA" : "") << '\n'
+            << "ENDHDR" << '\n';
+        return;
+    }
+
+    stream << width << ' ' << height << '\n';
+
+    if (filetype != P1 && filetype != P4)
+        stream << maxValue << '\n';
+}
+
+void RowWriter::writeRows(const Pixel *source, int rowCount)
+{
+    if (pixelFormat == FORMAT_RGB)
+    {
+        writeNativeRows(reinterpret_cast<const uint8_t *>(source), rowCount);
+        return;
+    }
+
+    size_t rowSize = PixelFormats::getRowSize(width, pixelFormat);
+
+    nativeBuffer.resize(rowSize * rowCount);
+    for (int y = 0; y < rowCount; y++)
+        PixelFormats::fromPixels(source + (size_t)y * width, nativeBuffer.data() + y * rowSize, pixelFormat, width, maxValue);
+
+    writeNativeRows(nativeBuffer.data(), rowCount);
+}
+
+void RowWriter::writeNativeRows(const uint8_t *source, int rowCount)
+{
+    if (rowCount > height - rowsWritten)
+        throw std::out_of_range("Writing more rows than the image height");
+
+    size_t pixelCount = (size_t)width * rowCount;
+    size_t rowSize = PixelFormats::getRowSize(width, pixelFormat);
+    size_t valueCount = pixelCount * PixelFormats::getChannelCount(pixelFormat);
+
+    switch (filetype)
+    {
+    case P1:
+        // one 0 or 1 value per pixel
+        valueBuffer.resize(pixelCount);
+        for (int y = 0; y < rowCount; y++)
+        {
+            const uint8_t *row = source + y * rowSize;
+            for (int x = 0; x < width; x++)
+                valueBuffer[(size_t)y * width + x] = (row[x / 8] >> (7 - x % 8)) & 1;
+        }
+        writeAsciiValues(valueBuffer.data(), pixelCount);
+        break;
+    case P2:
+    case P3:
+        if (PixelFormats::isDeep(pixelFormat))
+            writeAsciiValues(reinterpret_cast<const uint16_t *>(source), valueCount);
+        else
+            writeAsciiValues(source, valueCount);
+        break;
+    default:
+        if (PixelFormats::isDeep(pixelFormat))
+        {
+            // 16-bit values are big-endian in the file
+            valueBuffer.assign(source, source + rowSize * rowCount);
+            ChannelKernels::toBigEndian(reinterpret_cast<uint16_t *>(valueBuffer.data()), valueCount);
+            stream.write(reinterpret_cast<const char *>(valueBuffer.data()), valueBuffer.size());
+        }
+        else
+        {
+            stream.write(reinterpret_cast<const char *>(source), rowSize * rowCount);
+        }
+    }
+
+    rowsWritten += rowCount;
+}
+
+void RowWriter::setValuesPerLine(int count)
+{
+    valuesPerLine = std::clamp(count, 1, getMaxValuesPerLine());
+}
+
+int RowWriter::getMaxValuesPerLine() const
+{
+    // a value and its separator take 2 characters in bitmaps, up to 4 in 8-bit images and up to 6 in 16-bit ones
+    int valueLength = filetype == P1 ? 2 : std::to_string(maxValue).size() + 1;
+    return ASCII_MAX_LINE_LENGTH / valueLength;
+}
+
+template <typename Channel>
+void RowWriter::writeAsciiValues(const Channel *values, size_t valueCount)
+{
+    size_t firstValue = (size_t)rowsWritten * width * getValuesPerPixel(filetype);
+    int chunkCount = (valueCount + ASCII_CHUNK_VALUES - 1) / ASCII_CHUNK_VALUES;
+
+    if ((int)chunkBuffers.size() < chunkCount)
+        chunkBuffers.resize(chunkCount);
+
+    auto formatChunks = [&](int firstChunk, int lastChunk) {
+        for (int chunk = firstChunk; chunk < lastChunk; chunk++)
+        {
+            size_t chunkStart = (size_t)chunk * ASCII_CHUNK_VALUES;
+            size_t chunkSize = std::min((size_t)ASCII_CHUNK_VALUES, valueCount - chunkStart);
+
+            formatAsciiValues(values + chunkStart, chunkSize, firstValue + chunkStart, chunkBuffers[chunk]);
+        }
+    };
+
+    // the line breaks only depend on the value index, so chunks can be formatted independently
+    if (chunkCount > 1)
+        WorkerPool::getInstance().forEachRowBand(chunkCount, formatChunks);
+    else
+        formatChunks(0, chunkCount);
+
+    for (int chunk = 0; chunk < chunkCount; chunk++)
+        stream.write(chunkBuffers[chunk].data(), chunkBuffers[chunk].size());
+}
+
+template <typename Channel>
+void RowWriter::formatAsciiValues(const Channel *values, size_t count, size_t firstValue, std::vector<char> &output)
+{
+    // at most 3 (or 5) digits and a separator per value
+    const int maxLength = sizeof(Channel) == 1 ? 4 : 6;
+    output.resize(count * maxLength);
+
+    char *position = output.data();
+    int column = firstValue % valuesPerLine;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if constexpr (sizeof(Channel) == 1)
+        {
+            const DecimalDigits &entry = decimalTable.values[values[i]];
+
+            std::memcpy(position, entry.digits, 3);
+            position += entry.length;
+        }
+        else
+        {
+            position = std::to_chars(position, position + maxLength, values[i]).ptr;
+        }
+
+        if (++column == valuesPerLine)
+        {
+            *position++ = '\n';
+            column = 0;
+        }
+        else
+        {
+            *position++ = ' ';
+        }
+    }
+
+    // the last line of the image ends with a line break as well
+    if (firstValue + count == (size_t)width * height * getValuesPerPixel(filetype) && position[-1] == ' ')
+        position[-1] = '\n';
+
+    output.resize(position - output.data());
+}
+
+int RowStream::getBlockRows(int width)
+{
+    return std::max(1, STREAM_BLOCK_PIXELS / width);
+}
+
+void RowStream::forEachRow(std::istream &input, std::function<void(const Pixel *, int)> rowFunction, progressHandlerType progressHandler)
+{
+    RowReader reader(input);
+    int width = reader.getWidth();
+    int height = reader.getHeight();
+    int blockRows = getBlockRows(width);
+    std::vector<Pixel> block((size_t)width * blockRows);
+
+    if (progressHandler)
+        progressHandler(0);
+
+    while (reader.hasMoreRows())
+    {
+        int firstRow = reader.getRowsRead();
+        int rowCount = reader.readRows(block.data(), blockRows);
+
+        for (int y = 0; y < rowCount; y++)
+            rowFunction(block.data() + (size_t)y * width, firstRow + y);
+
+        if (progressHandler)
+            progressHandler(reader.getRowsRead() / (float)height * 100);
+    }
+}
+
+void RowStream::transform(std::istream &input, std::ostream &output, FILETYPE filetype, rowTransformFunction transform, progressHandlerType progressHandler)
+{
+    RowReader reader(input);
+    int width = reader.getWidth();
+    int height = reader.getHeight();
+    int blockRows = getBlockRows(width);
+    std::vector<Pixel> block((size_t)width * blockRows);
+
+    RowWriter writer(output, filetype, width, height);
+
+    if (progressHandler)
+        progressHandler(0);
+
+    while (reader.hasMoreRows())
+    {
+        int rowCount = reader.readRows(block.data(), blockRows);
+
+        WorkerPool::getInstance().forEachRowBand(rowCount, [&](int firstRow, int lastRow) {
+            for (int y = firstRow; y < lastRow; y++)
+                transform(block.data() + (size_t)y * width, width);
+        });
+
+        writer.writeRows(block.data(), rowCount);
+
+        if (output.fail())
+            throw stream_corrupt_exception("Failed to write the output stream", false);
+        if (progressHandler)
+            progressHandler(reader.getRowsRead() / (float)height * 100);
+    }
+}
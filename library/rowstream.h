@@ -0,0 +1,107 @@
+#pragma once
+#include "asciiscanner.h"
+#include "bitmap.h"
+#include "parser.h"
+#include <memory>
+#include <vector>
+
+// Decodes a PNM or PAM stream a block of rows at a time, so images larger than the memory can be processed.
+class RowReader {
+    public:
+        // Reads the header, leaving the stream at the first row. Unlike Bitmap, images of any size are accepted.
+        RowReader(std::istream &stream);
+
+        // Continues from a header which was already read from the stream.
+        RowReader(std::istream &stream, const BitmapHeader &header);
+
+        const BitmapHeader &getHeader() const { return header; }
+        int getWidth() const { return header.width; }
+        int getHeight() const { return header.height; }
+
+        // Returns the pixel format matching the file, which readNativeRows decodes into.
+        PIXEL_FORMAT getPixelFormat() const { return pixelFormat; }
+
+        // Returns the number of rows decoded so far.
+        int getRowsRead() const { return rowsRead; }
+
+        bool hasMoreRows() const { return rowsRead < header.height; }
+
+        // Decodes up to rowCount next rows into destination, which must hold rowCount * width pixels.
+        // Returns the number of rows decoded, which is only less than rowCount at the end of the image.
+        int readRows(Pixel *destination, int rowCount);
+
+        // Decodes up to rowCount next rows into destination, stored in the pixel format of the file (see getPixelFormat).
+        int readNativeRows(uint8_t *destination, int rowCount);
+    private:
+        std::istream &stream;
+        BitmapHeader header;
+        PIXEL_FORMAT pixelFormat;
+        int rowsRead = 0;
+        // ASCII pixel data is tokenized by a scanner reading ahead in blocks
+        std::unique_ptr<AsciiScanner> scanner;
+        // A single channel row, before its expansion into RGB
+        std::vector<uint8_t> rowInput;
+};
+
+// Encodes a PNM stream a block of rows at a time, the counterpart of RowReader.
+class RowWriter {
+    public:
+        // Writes the header of an image of given size. Color is dropped for the grayscale formats (P2, P5),
+        // and bitmaps (P1, P4) use the treshold of the black and white transformation.
+        // maxValue is either 255 or a 16-bit value, and is ignored by bitmaps.
+        // PAM (P7) stores the channels of tupleFormat (bilevel being stored as gray), the other filetypes ignore it.
+        RowWriter(std::ostream &stream, FILETYPE filetype, int width, int height, int maxValue = 255, PIXEL_FORMAT tupleFormat = FORMAT_RGB);
+
+        // Returns the pixel format matching the file, which writeNativeRows encodes from.
+        PIXEL_FORMAT getPixelFormat() const { return pixelFormat; }
+
+        // Encodes rowCount rows from source, which holds rowCount * width pixels.
+        // Large blocks of ASCII rows are formatted on the shared WorkerPool, and written in order.
+        void writeRows(const Pixel *source, int rowCount);
+
+        // Encodes rowCount rows from source, stored in the pixel format of the file (see getPixelFormat).
+        void writeNativeRows(const uint8_t *source, int rowCount);
+
+        // Sets the number of ASCII values per line, capped so lines stay within the 70 characters PNM recommends.
+        // Must be called before writing any rows.
+        void setValuesPerLine(int count);
+        int getMaxValuesPerLine() const;
+
+        // Returns the number of rows encoded so far.
+        int getRowsWritten() const { return rowsWritten; }
+
+        bool isComplete() const { return rowsWritten == height; }
+    private:
+        template <typename Channel>
+        void writeAsciiValues(const Channel *values, size_t valueCount);
+        template <typename Channel>
+        void formatAsciiValues(const Channel *values, size_t count, size_t firstValue, std::vector<char> &output);
+
+        std::ostream &stream;
+        FILETYPE filetype;
+        int width;
+        int height;
+        int maxValue;
+        PIXEL_FORMAT pixelFormat;
+        int rowsWritten = 0;
+        int valuesPerLine;
+        // Pixels of the block being written, converted into the file pixel format
+        std::vector<uint8_t> nativeBuffer;
+        // Bits or byte-swapped 16-bit values of the block being written
+        std::vector<uint8_t> valueBuffer;
+        // One formatted chunk of ASCII values per buffer, reused between writes
+        std::vector<std::vector<char>> chunkBuffers;
+};
+
+// Whole image operations running on a stream, holding only a block of rows in memory at a time.
+namespace RowStream {
+    // Returns the number of rows processed at a time for images of given width.
+    int getBlockRows(int width);
+
+    // Calls rowFunction(row, y) for each row of the image, in order.
+    void forEachRow(std::istream &input, std::function<void(const Pixel *, int)> rowFunction, progressHandlerType progressHandler = nullptr);
+
+    // Decodes the image from input, transforms every row, and encodes the result into output as given filetype.
+    // Rows of a block are transformed on the shared WorkerPool, like Bitmap::transformRows.
+    void transform(std::istream &input, std::ostream &output, FILETYPE filetype, rowTransformFunction transform, progressHandlerType progressHandler = nullptr);
+}
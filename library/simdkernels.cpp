@@ -0,0 +1,641 @@
+#include "simdkernels.h"
+#include "transformations.h"
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE2
+#define TARGET_AVX2
+#endif
+
+namespace SimdKernels
+{
+    typedef void (*rowKernel)(Pixel *, int);
+    typedef void (*rowCombinationKernel)(const Pixel *, const Pixel *, Pixel *, int);
+
+    // Set of kernels implemented with a single instruction set
+    struct KernelTable {
+        INSTRUCTION_SET instructionSet;
+        rowKernel negative;
+        rowKernel grayscale;
+        rowKernel blacknwhite;
+        rowCombinationKernel add;
+        rowCombinationKernel substract;
+        rowCombinationKernel multiply;
+        rowCombinationKernel downsample;
+    };
+
+    // Scalar kernels, also used for the tails of rows not filling a whole vector
+
+    static void negativeScalar(Pixel *row, int width)
+    {
+        for (int x = 0; x < width; x++)
+            row[x] = PixelTransformations::negative(row[x]);
+    }
+
+    static void grayscaleScalar(Pixel *row, int width)
+    {
+        for (int x = 0; x < width; x++)
+            row[x] = PixelTransformations::grayscale(row[x]);
+    }
+
+    static void blacknwhiteScalar(Pixel *row, int width)
+    {
+        for (int x = 0; x < width; x++)
+            row[x] = PixelTransformations::blacknwhite(row[x]);
+    }
+
+    static void addScalar(const Pixel *row1, const Pixel *row2, Pixel *destination, int width)
+    {
+        for (int x = 0; x < width; x++)
+            destination[x] = PixelCombinations::add(row1[x], row2[x]);
+    }
+
+    static void substractScalar(const Pixel *row1, const Pixel *row2, Pixel *destination, int width)
+    {
+        for (int x = 0; x < width; x++)
+            destination[x] = PixelCombinations::substract(row1[x], row2[x]);
+    }
+
+    static void multiplyScalar(const Pixel *row1, const Pixel *row2, Pixel *destination, int width)
+    {
+        for (int x = 0; x < width; x++)
+            destination[x] = PixelCombinations::multiply(row1[x], row2[x]);
+    }
+
+    // Redoes the bytes set in mask with PixelCombinations::multiply. Exact quotients a * b / 255 may come out one below
+    // in its double arithmetic, while the vector kernels divide in integers.
+    static void multiplyExactQuotients(const uint8_t *bytes1, const uint8_t *bytes2, uint8_t *destination, unsigned mask)
+    {
+        for (int i = 0; mask; i++, mask >>= 1)
+        {
+            if (mask & 1)
+                destination[i] = PixelCombinations::multiply(Pixel(bytes1[i], 0, 0), Pixel(bytes2[i], 0, 0)).r;
+        }
+    }
+
+    static void downsampleScalar(const Pixel *row1, const Pixel *row2, Pixel *destination, int width)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            const Pixel *top = row1 + 2 * x;
+            const Pixel *bottom = row2 + 2 * x;
+            destination[x] = Pixel((top[0].r + top[1].r + bottom[0].r + bottom[1].r + 2) / 4,
+                                   (top[0].g + top[1].g + bottom[0].g + bottom[1].g + 2) / 4,
+                                   (top[0].b + top[1].b + bottom[0].b + bottom[1].b + 2) / 4);
+        }
+    }
+
+    static const KernelTable scalarKernels = {
+        SCALAR, negativeScalar, grayscaleScalar, blacknwhiteScalar, addScalar, substractScalar, multiplyScalar, downsampleScalar
+    };
+
+#ifdef SIMD_X86
+    // Channel-wise kernels treat the row as plain bytes, so whole vectors are processed regardless of pixel boundaries.
+    // Vectors are loaded before they are stored, so destination may alias either source.
+
+    // SSE2
+
+    TARGET_SSE2 static void negativeSSE2(Pixel *row, int width)
+    {
+        uint8_t *bytes = reinterpret_cast<uint8_t *>(row);
+        size_t byteCount = (size_t)width * sizeof(Pixel);
+        size_t i = 0;
+        const __m128i ones = _mm_set1_epi8((char)0xFF);
+
+        for (; i + 16 <= byteCount; i += 16)
+        {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(bytes + i), _mm_xor_si128(v, ones));
+        }
+        for (; i < byteCount; i++)
+            bytes[i] = 255 - bytes[i];
+    }
+
+    // floor((a + b) / 2), pavgb rounds up so the carried low bit is subtracted
+    TARGET_SSE2 static inline __m128i addBytesSSE2(__m128i a, __m128i b)
+    {
+        __m128i roundingBit = _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1));
+        return _mm_sub_epi8(_mm_avg_epu8(a, b), roundingBit);
+    }
+
+    // floor(a * b / 255) on 16-bit lanes, using (t + 1 + (t >> 8)) >> 8
+    TARGET_SSE2 static inline __m128i divideBy255SSE2(__m128i product)
+    {
+        __m128i t = _mm_add_epi16(product, _mm_add_epi16(_mm_srli_epi16(product, 8), _mm_set1_epi16(1)));
+        return _mm_srli_epi16(t, 8);
+    }
+
+    TARGET_SSE2 static inline __m128i substractBytesSSE2(__m128i a, __m128i b)
+    {
+        return _mm_subs_epu8(a, b);
+    }
+
+    // 0xFFFF on the 16-bit lanes where the product is a nonzero multiple of 255
+    TARGET_SSE2 static inline __m128i exactQuotientsSSE2(__m128i product, __m128i quotient)
+    {
+        __m128i exact = _mm_cmpeq_epi16(_mm_sub_epi16(_mm_slli_epi16(quotient, 8), quotient), product);
+        return _mm_andnot_si128(_mm_cmpeq_epi16(product, _mm_setzero_si128()), exact);
+    }
+
+    // Sets exactQuotients to 0xFF on the bytes to redo with multiplyExactQuotients
+    TARGET_SSE2 static inline __m128i multiplyBytesSSE2(__m128i a, __m128i b, __m128i &exactQuotients)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i low = _mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+        __m128i high = _mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+        __m128i lowQuotient = divideBy255SSE2(low);
+        __m128i highQuotient = divideBy255SSE2(high);
+
+        exactQuotients = _mm_packs_epi16(exactQuotientsSSE2(low, lowQuotient), exactQuotientsSSE2(high, highQuotient));
+        return _mm_packus_epi16(lowQuotient, highQuotient);
+    }
+
+    // Runs a channel-wise combination over whole vectors, and the scalar kernel over the remaining pixels.
+    template <__m128i (*vectorOp)(__m128i, __m128i)>
+    TARGET_SSE2 static inline void combineSSE2(const Pixel *row1, const Pixel *row2, Pixel *destination, int width,
+                                               rowCombinationKernel scalarKernel)
+    {
+        const uint8_t *bytes1 = reinterpret_cast<const uint8_t *>(row1);
+        const uint8_t *bytes2 = reinterpret_cast<const uint8_t *>(row2);
+        uint8_t *destinationBytes = reinterpret_cast<uint8_t *>(destination);
+
+        // 48 bytes are always a whole number of pixels
+        int vectorPixels = width / 16 * 16;
+        size_t byteCount = (size_t)vectorPixels * sizeof(Pixel);
+
+        for (size_t i = 0; i < byteCount; i += 16)
+        {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes1 + i));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes2 + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(destinationBytes + i), vectorOp(a, b));
+        }
+
+        scalarKernel(row1 + vectorPixels, row2 + vectorPixels, destination + vectorPixels, width - vectorPixels);
+    }
+
+    TARGET_SSE2 static void addSSE2(const Pixel *row1, const Pixel *row2, Pixel *destination, int width)
+    {
+        combineSSE2<addBytesSSE2>(row1, row2, destination, width, addScalar);
+    }
+
+    TARGET_SSE2 static void substractSSE2(const Pixel *row1, const Pixel *row2, Pixel *destination, int width)
+    {
+        combineSSE2<substractBytesSSE2>(row1, row2, destination, width, substractScalar);
+    }
+
+    TARGET_SSE2 static void multiplySSE2(const Pixel *row1, const Pixel *row2, Pixel *destination, int width)
+    {
+        const uint8_t *bytes1 = reinterpret_cast<const uint8_t *>(row1);
+        const uint8_t *bytes2 = reinterpret_cast<const uint8_t *>(row2);
+        uint8_t *destinationBytes = reinterpret_cast<uint8_t *>(destination);
+
+        int vectorPixels = width / 16 * 16;
+        size_t byteCount = (size_t)vectorPixels * sizeof(Pixel);
+
+        for (size_t i = 0; i < byteCount; i += 16)
+        {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes1 + i));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes2 + i));
+            __m128i exactQuotients;
+            __m128i result = multiplyBytesSSE2(a, b, exactQuotients);
+            unsigned mask = _mm_movemask_epi8(exactQuotients);
+
+            // the sources are kept aside first, destination may alias them
+            alignas(16) uint8_t sources1[16], sources2[16];
+            if (mask)
+            {
+                _mm_store_si128(reinterpret_cast<__m128i *>(sources1), a);
+                _mm_store_si128(reinterpret_cast<__m128i *>(sources2), b);
+            }
+
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(destinationBytes + i), result);
+
+            if (mask)
+                multiplyExactQuotients(sources1, sources2, destinationBytes + i, mask);
+        }
+
+        multiplyScalar(row1 + vectorPixels, row2 + vectorPixels, destination + vectorPixels, width - vectorPixels);
+    }
+
+    // SSE2 has no byte shuffle, so grayscale, blacknwhite and downsample, which mix pixels or channels, stay scalar there
+    static const KernelTable sse2Kernels = {
+        SSE2, negativeSSE2, grayscaleScalar, blacknwhiteScalar, addSSE2, substractSSE2, multiplySSE2, downsampleScalar
+    };
+
+    // AVX2
+
+    TARGET_AVX2 static void negativeAVX2(Pixel *row, int width)
+    {
+        uint8_t *bytes = reinterpret_cast<uint8_t *>(row);
+        size_t byteCount = (size_t)width * sizeof(Pixel);
+        size_t i = 0;
+        const __m256i ones = _mm256_set1_epi8((char)0xFF);
+
+        for (; i + 32 <= byteCount; i += 32)
+        {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bytes + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(bytes + i), _mm256_xor_si256(v, ones));
+        }
+        for (; i < byteCount; i++)
+            bytes[i] = 255 - bytes[i];
+    }
+
+    TARGET_AVX2 static inline __m256i addBytesAVX2(__m256i a, __m256i b)
+    {
+        __m256i roundingBit = _mm256_and_si256(_mm256_xor_si256(a, b), _mm256_set1_epi8(1));
+        return _mm256_sub_epi8(_mm256_avg_epu8(a, b), roundingBit);
+    }
+
+    TARGET_AVX2 static inline __m256i divideBy255AVX2(__m256i product)
+    {
+        __m256i t = _mm256_add_epi16(product, _mm256_add_epi16(_mm256_srli_epi16(product, 8), _mm256_set1_epi16(1)));
+        return _mm256_srli_epi16(t, 8);
+    }
+
+    TARGET_AVX2 static inline __m256i substractBytesAVX2(__m256i a, __m256i b)
+    {
+        return _mm256_subs_epu8(a, b);
+    }
+
+    TARGET_AVX2 static inline __m256i exactQuotientsAVX2(__m256i product, __m256i quotient)
+    {
+        __m256i exact = _mm256_cmpeq_epi16(_mm256_sub_epi16(_mm256_slli_epi16(quotient, 8), quotient), product);
+        return _mm256_andnot_si256(_mm256_cmpeq_epi16(product, _mm256_setzero_si256()), exact);
+    }
+
+    // Unpacking and packing both work within 128-bit lanes, so the byte order is preserved
+    TARGET_AVX2 static inline __m256i multiplyBytesAVX2(__m256i a, __m256i b, __m256i &exactQuotients)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+        __m256i low = _mm256_mullo_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero));
+        __m256i high = _mm256_mullo_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero));
+        __m256i lowQuotient = divideBy255AVX2(low);
+        __m256i highQuotient = divideBy255AVX2(high);
+
+        exactQuotients = _mm256_packs_epi16(exactQuotientsAVX2(low, lowQuotient), exactQuotientsAVX2(high, highQuotient));
+        return _mm256_packus_epi16(lowQuotient, highQuotient);
+    }
+
+    template <__m256i (*vectorOp)(__m256i, __m256i)>
+    TARGET_AVX2 static inline void combineAVX2(const Pixel *row1, const Pixel *row2, Pixel *destination, int width,
+                                               rowCombinationKernel scalarKernel)
+    {
+        const uint8_t *bytes1 = reinterpret_cast<const uint8_t *>(row1);
+        const uint8_t *bytes2 = reinterpret_cast<const uint8_t *>(row2);
+        uint8_t *destinationBytes = reinterpret_cast<uint8_t *>(destination);
+
+        // 96 bytes are always a whole number of pixels
+        int vectorPixels = width / 32 * 32;
+        size_t byteCount = (size_t)vectorPixels * sizeof(Pixel);
+
+        for (size_t i = 0; i < byteCount; i += 32)
+        {
+            __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bytes1 + i));
+            __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bytes2 + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(destinationBytes + i), vectorOp(a, b));
+        }
+
+        scalarKernel(row1 + vectorPixels, row2 + vectorPixels, destination + vectorPixels, width - vectorPixels);
+    }
+
+    TARGET_AVX2 static void addAVX2(const Pixel *row1, const Pixel *row2, Pixel *destination, int width)
+    {
+        combineAVX2<addBytesAVX2>(row1, row2, destination, width, addScalar);
+    }
+
+    TARGET_AVX2 static void substractAVX2(const Pixel *row1, const Pixel *row2, Pixel *destination, int width)
+    {
+        combineAVX2<substractBytesAVX2>(row1, row2, destination, width, substractScalar);
+    }
+
+    TARGET_AVX2 static void multiplyAVX2(const Pixel *row1, const Pixel *row2, Pixel *destination, int width)
+    {
+        const uint8_t *bytes1 = reinterpret_cast<const uint8_t *>(row1);
+        const uint8_t *bytes2 = reinterpret_cast<const uint8_t *>(row2);
+        uint8_t *destinationBytes = reinterpret_cast<uint8_t *>(destination);
+
+        int vectorPixels = width / 32 * 32;
+        size_t byteCount = (size_t)vectorPixels * sizeof(Pixel);
+
+        for (size_t i = 0; i < byteCount; i += 32)
+        {
+            __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bytes1 + i));
+            __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bytes2 + i));
+            __m256i exactQuotients;
+            __m256i result = multiplyBytesAVX2(a, b, exactQuotients);
+            unsigned mask = (unsigned)_mm256_movemask_epi8(exactQuotients);
+
+            alignas(32) uint8_t sources1[32], sources2[32];
+            if (mask)
+            {
+                _mm256_store_si256(reinterpret_cast<__m256i *>(sources1), a);
+                _mm256_store_si256(reinterpret_cast<__m256i *>(sources2), b);
+            }
+
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(destinationBytes + i), result);
+
+            if (mask)
+                multiplyExactQuotients(sources1, sources2, destinationBytes + i, mask);
+        }
+
+        multiplyScalar(row1 + vectorPixels, row2 + vectorPixels, destination + vectorPixels, width - vectorPixels);
+    }
+
+    // Shuffle masks for 16 pixels (48 bytes, loaded as three 16-byte parts).
+    // Deinterleave masks gather one channel of a part into its place in a 16-byte plane,
+    // interleave masks spread a 16-byte plane of gray values into a part, repeating each value 3 times.
+    struct ShuffleMasks {
+        __m128i deinterleave[3][3];
+        __m128i interleave[3];
+    };
+
+    TARGET_AVX2 static ShuffleMasks makeShuffleMasks()
+    {
+        ShuffleMasks masks;
+        alignas(16) int8_t mask[16];
+
+        for (int channel = 0; channel < 3; channel++)
+        {
+            for (int part = 0; part < 3; part++)
+            {
+                for (int pixel = 0; pixel < 16; pixel++)
+                {
+                    int source = pixel * 3 + channel - part * 16;
+                    mask[pixel] = (source >= 0 && source < 16) ? source : -1;
+                }
+                masks.deinterleave[channel][part] = _mm_load_si128(reinterpret_cast<const __m128i *>(mask));
+            }
+        }
+
+        for (int part = 0; part < 3; part++)
+        {
+            for (int i = 0; i < 16; i++)
+                mask[i] = (part * 16 + i) / 3;
+            masks.interleave[part] = _mm_load_si128(reinterpret_cast<const __m128i *>(mask));
+        }
+
+        return masks;
+    }
+
+    TARGET_AVX2 static inline __m128i gatherChannel(const ShuffleMasks &masks, int channel, __m128i part0, __m128i part1, __m128i part2)
+    {
+        return _mm_or_si128(
+            _mm_or_si128(_mm_shuffle_epi8(part0, masks.deinterleave[channel][0]), _mm_shuffle_epi8(part1, masks.deinterleave[channel][1])),
+            _mm_shuffle_epi8(part2, masks.deinterleave[channel][2]));
+    }
+
+    // Runs a kernel mixing the channels of 16 pixels at a time. The plane kernel gets the 16-bit R, G and B planes,
+    // and returns one 16-bit value per pixel (0-255), which is written to all three channels.
+    // The 16 pixels go through the scalar kernel instead when scalarLanes returns a nonzero lane for any of them.
+    template <__m256i (*planeKernel)(__m256i, __m256i, __m256i), __m256i (*scalarLanes)(__m256i, __m256i, __m256i)>
+    TARGET_AVX2 static inline void mixChannelsAVX2(Pixel *row, int width, rowKernel scalarKernel)
+    {
+        static const ShuffleMasks masks = makeShuffleMasks();
+        uint8_t *bytes = reinterpret_cast<uint8_t *>(row);
+        int vectorPixels = width / 16 * 16;
+
+        for (int x = 0; x < vectorPixels; x += 16)
+        {
+            uint8_t *pixels = bytes + (size_t)x * sizeof(Pixel);
+            __m128i part0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels));
+            __m128i part1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels + 16));
+            __m128i part2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels + 32));
+
+            __m256i r = _mm256_cvtepu8_epi16(gatherChannel(masks, 0, part0, part1, part2));
+            __m256i g = _mm256_cvtepu8_epi16(gatherChannel(masks, 1, part0, part1, part2));
+            __m256i b = _mm256_cvtepu8_epi16(gatherChannel(masks, 2, part0, part1, part2));
+
+            __m256i redone = scalarLanes(r, g, b);
+            if (!_mm256_testz_si256(redone, redone))
+            {
+                scalarKernel(row + x, 16);
+                continue;
+            }
+
+            __m256i values = planeKernel(r, g, b);
+            __m128i plane = _mm_packus_epi16(_mm256_castsi256_si128(values), _mm256_extracti128_si256(values, 1));
+
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(pixels), _mm_shuffle_epi8(plane, masks.interleave[0]));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(pixels + 16), _mm_shuffle_epi8(plane, masks.interleave[1]));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(pixels + 32), _mm_shuffle_epi8(plane, masks.interleave[2]));
+        }
+
+        scalarKernel(row + vectorPixels, width - vectorPixels);
+    }
+
+    TARGET_AVX2 static inline __m256i noScalarLanes(__m256i, __m256i, __m256i)
+    {
+        return _mm256_setzero_si256();
+    }
+
+    // (r + g + b) / 3, as (sum * 0xAAAB) >> 17 which is exact for sums up to 765
+    TARGET_AVX2 static inline __m256i grayscalePlanes(__m256i r, __m256i g, __m256i b)
+    {
+        __m256i sum = _mm256_add_epi16(_mm256_add_epi16(r, g), b);
+        return _mm256_srli_epi16(_mm256_mulhi_epu16(sum, _mm256_set1_epi16((short)0xAAAB)), 1);
+    }
+
+    // 300r + 587g + 114b, which needs 32 bits, as the low and high halves of the lanes. madd pairs the channels up.
+    TARGET_AVX2 static inline void luminanceSums(__m256i r, __m256i g, __m256i b, __m256i &low, __m256i &high)
+    {
+        const __m256i redGreenWeights = _mm256_set1_epi32((587 << 16) | 300);
+        const __m256i blueWeights = _mm256_set1_epi32(114);
+        const __m256i zero = _mm256_setzero_si256();
+
+        low = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(r, g), redGreenWeights),
+                               _mm256_madd_epi16(_mm256_unpacklo_epi16(b, zero), blueWeights));
+        high = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(r, g), redGreenWeights),
+                                _mm256_madd_epi16(_mm256_unpackhi_epi16(b, zero), blueWeights));
+    }
+
+    // 255 where 300r + 587g + 114b is over 128000, 0 elsewhere. A sum of exactly 128000 is left to blacknwhiteTreshold.
+    TARGET_AVX2 static inline __m256i blacknwhitePlanes(__m256i r, __m256i g, __m256i b)
+    {
+        const __m256i treshold = _mm256_set1_epi32(128000);
+        __m256i low, high;
+        luminanceSums(r, g, b, low, high);
+
+        __m256i white = _mm256_packs_epi32(_mm256_cmpgt_epi32(low, treshold), _mm256_cmpgt_epi32(high, treshold));
+        return _mm256_and_si256(white, _mm256_set1_epi16(255));
+    }
+
+    // The lanes summing to exactly 128000, a luminance of 128 which the double arithmetic of
+    // PixelTransformations::blacknwhite may compute just below it
+    TARGET_AVX2 static inline __m256i blacknwhiteTreshold(__m256i r, __m256i g, __m256i b)
+    {
+        const __m256i treshold = _mm256_set1_epi32(128000);
+        __m256i low, high;
+        luminanceSums(r, g, b, low, high);
+
+        return _mm256_or_si256(_mm256_cmpeq_epi32(low, treshold), _mm256_cmpeq_epi32(high, treshold));
+    }
+
+    TARGET_AVX2 static void grayscaleAVX2(Pixel *row, int width)
+    {
+        mixChannelsAVX2<grayscalePlanes, noScalarLanes>(row, width, grayscaleScalar);
+    }
+
+    TARGET_AVX2 static void blacknwhiteAVX2(Pixel *row, int width)
+    {
+        mixChannelsAVX2<blacknwhitePlanes, blacknwhiteTreshold>(row, width, blacknwhiteScalar);
+    }
+
+    // 4 destination pixels at a time, from 8 source pixels (24 bytes) of each row, loaded at offsets 0 and 8.
+    // The channels of each pair of pixels are shuffled next to each other, so maddubs adds them into 16-bit lanes.
+    TARGET_AVX2 static void downsampleAVX2(const Pixel *row1, const Pixel *row2, Pixel *destination, int width)
+    {
+        const __m128i firstPairs = _mm_setr_epi8(0, 3, 1, 4, 2, 5, 6, 9, 7, 10, 8, 11, -1, -1, -1, -1);
+        const __m128i secondPairs = _mm_setr_epi8(4, 7, 5, 8, 6, 9, 10, 13, 11, 14, 12, 15, -1, -1, -1, -1);
+        const __m128i compact = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 8, 9, 10, 11, 12, 13, -1, -1, -1, -1);
+        const __m128i ones = _mm_set1_epi8(1);
+        const __m128i rounding = _mm_set1_epi16(2);
+
+        const uint8_t *bytes1 = reinterpret_cast<const uint8_t *>(row1);
+        const uint8_t *bytes2 = reinterpret_cast<const uint8_t *>(row2);
+        uint8_t *destinationBytes = reinterpret_cast<uint8_t *>(destination);
+        int vectorPixels = width / 4 * 4;
+
+        for (int x = 0; x < vectorPixels; x += 4)
+        {
+            size_t source = (size_t)x * 2 * sizeof(Pixel);
+
+            __m128i first = _mm_add_epi16(
+                _mm_maddubs_epi16(_mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes1 + source)), firstPairs), ones),
+                _mm_maddubs_epi16(_mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes2 + source)), firstPairs), ones));
+            __m128i second = _mm_add_epi16(
+                _mm_maddubs_epi16(_mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes1 + source + 8)), secondPairs), ones),
+                _mm_maddubs_epi16(_mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes2 + source + 8)), secondPairs), ones));
+
+            first = _mm_srli_epi16(_mm_add_epi16(first, rounding), 2);
+            second = _mm_srli_epi16(_mm_add_epi16(second, rounding), 2);
+
+            // 12 bytes are stored, a whole vector would run past the end of the row
+            __m128i result = _mm_shuffle_epi8(_mm_packus_epi16(first, second), compact);
+            uint8_t *pixels = destinationBytes + (size_t)x * sizeof(Pixel);
+            uint32_t last = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(result, 8));
+
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(pixels), result);
+            std::memcpy(pixels + 8, &last, sizeof(last));
+        }
+
+        downsampleScalar(row1 + 2 * vectorPixels, row2 + 2 * vectorPixels, destination + vectorPixels, width - vectorPixels);
+    }
+
+    static const KernelTable avx2Kernels = {
+        AVX2, negativeAVX2, grayscaleAVX2, blacknwhiteAVX2, addAVX2, substractAVX2, multiplyAVX2, downsampleAVX2
+    };
+#endif
+
+    static INSTRUCTION_SET detectInstructionSet()
+    {
+#if defined(SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return AVX2;
+        if (__builtin_cpu_supports("sse2"))
+            return SSE2;
+#elif defined(SIMD_X86) && defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        int maxLeaf = info[0];
+
+        __cpuid(info, 1);
+        bool hasSSE2 = (info[3] & (1 << 26)) != 0;
+        bool osSavesAVX = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+
+        if (maxLeaf >= 7 && osSavesAVX)
+        {
+            __cpuidex(info, 7, 0);
+            if (info[1] & (1 << 5))
+                return AVX2;
+        }
+        if (hasSSE2)
+            return SSE2;
+#endif
+        return SCALAR;
+    }
+
+    static const KernelTable *kernelsFor(INSTRUCTION_SET instructionSet)
+    {
+#ifdef SIMD_X86
+        if (instructionSet == AVX2)
+            return &avx2Kernels;
+        if (instructionSet == SSE2)
+            return &sse2Kernels;
+#endif
+        return &scalarKernels;
+    }
+
+    static std::atomic<const KernelTable *> &activeKernels()
+    {
+        static std::atomic<const KernelTable *> kernels { kernelsFor(getSupportedInstructionSet()) };
+        return kernels;
+    }
+
+    INSTRUCTION_SET getSupportedInstructionSet()
+    {
+        static const INSTRUCTION_SET supported = detectInstructionSet();
+        return supported;
+    }
+
+    INSTRUCTION_SET getInstructionSet()
+    {
+        return activeKernels().load()->instructionSet;
+    }
+
+    void setInstructionSet(INSTRUCTION_SET instructionSet)
+    {
+        if (instructionSet > getSupportedInstructionSet())
+            instructionSet = getSupportedInstructionSet();
+
+        activeKernels() = kernelsFor(instructionSet);
+    }
+
+    void negative(Pixel *row, int width)
+    {
+        activeKernels().load(std::memory_order_relaxed)->negative(row, width);
+    }
+
+    void grayscale(Pixel *row, int width)
+    {
+        activeKernels().load(std::memory_order_relaxed)->grayscale(row, width);
+    }
+
+    void blacknwhite(Pixel *row, int width)
+    {
+        activeKernels().load(std::memory_order_relaxed)->blacknwhite(row, width);
+    }
+
+    void add(const Pixel *row1, const Pixel *row2, Pixel *destination, int width)
+    {
+        activeKernels().load(std::memory_order_relaxed)->add(row1, row2, destination, width);
+    }
+
+    void substract(const Pixel *row1, const Pixel *row2, Pixel *destination, int width)
+    {
+        activeKernels().load(std::memory_order_relaxed)->substract(row1, row2, destination, width);
+    }
+
+    void multiply(const Pixel *row1, const Pixel *row2, Pixel *destination, int width)
+    {
+        activeKernels().load(std::memory_order_relaxed)->multiply(row1, row2, destination, width);
+    }
+
+    void downsample(const Pixel *row1, const Pixel *row2, Pixel *destination, int width)
+    {
+        activeKernels().load(std::memory_order_relaxed)->downsample(row1, row2, destination, width);
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include "pixel.h"
+
+// Hand vectorized row kernels, working directly on interleaved RGB rows. The best instruction set supported by the CPU
+// is picked at runtime, with a scalar fallback. Results are bit-exact with the PixelTransformations and PixelCombinations functions.
+namespace SimdKernels {
+    // Represents the instruction set used by the kernels
+    enum INSTRUCTION_SET
+    {
+        // Plain C++, works everywhere
+        SCALAR,
+        // 16 bytes at a time, x86-64 baseline
+        SSE2,
+        // 32 bytes at a time, with byte shuffles for the kernels mixing channels
+        AVX2
+    };
+
+    // Returns the instruction set currently used by the kernels.
+    INSTRUCTION_SET getInstructionSet();
+
+    // Returns the best instruction set supported by this CPU.
+    INSTRUCTION_SET getSupportedInstructionSet();
+
+    // Forces the kernels to use given instruction set, capped at the one supported by this CPU.
+    void setInstructionSet(INSTRUCTION_SET instructionSet);
+
+    void negative(Pixel *row, int width);
+    void grayscale(Pixel *row, int width);
+    void blacknwhite(Pixel *row, int width);
+
+    // Combination kernels, destination may be the same row as either of the sources.
+    void add(const Pixel *row1, const Pixel *row2, Pixel *destination, int width);
+    void substract(const Pixel *row1, const Pixel *row2, Pixel *destination, int width);
+    void multiply(const Pixel *row1, const Pixel *row2, Pixel *destination, int width);
+
+    // Halves two rows of 2 * width pixels into width pixels, each the rounded average of a 2x2 square of the sources.
+    void downsample(const Pixel *row1, const Pixel *row2, Pixel *destination, int width);
+}
@@ -0,0 +1,92 @@
+#include "tilecodec.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#define MAX_PACKET_LENGTH 128
+#define MIN_RUN_LENGTH 3
+
+namespace TileCodec {
+    std::vector<uint8_t> encode(const uint8_t *tile, size_t size, size_t rowBytes, int pixelBytes)
+    {
+        // differences with the previous pixel of the row, the first pixel of a row is kept as is
+        std::vector<uint8_t> deltas(size);
+
+        for (size_t rowStart = 0; rowStart < size; rowStart += rowBytes)
+        {
+            size_t rowEnd = std::min(rowStart + rowBytes, size);
+            size_t first = std::min(rowStart + pixelBytes, rowEnd);
+
+            std::memcpy(deltas.data() + rowStart, tile + rowStart, first - rowStart);
+            for (size_t i = first; i < rowEnd; i++)
+                deltas[i] = tile[i] - tile[i - pixelBytes];
+        }
+
+        // packets start with a header byte: 0-127 for 1-128 literal bytes, 129-255 for a byte repeated 128-2 times
+        std::vector<uint8_t> encoded;
+        encoded.reserve(size / 4);
+
+        size_t i = 0;
+        while (i < size)
+        {
+            size_t run = 1;
+            while (i + run < size && run < MAX_PACKET_LENGTH && deltas[i + run] == deltas[i])
+                run++;
+
+            if (run >= MIN_RUN_LENGTH)
+            {
+                encoded.push_back((uint8_t)(257 - run));
+                encoded.push_back(deltas[i]);
+                i += run;
+                continue;
+            }
+
+            // literals continue until the next run worth packing
+            size_t end = i + 1;
+            while (end < size && end - i < MAX_PACKET_LENGTH && !(end + 2 < size && deltas[end] == deltas[end + 1] && deltas[end] == deltas[end + 2]))
+                end++;
+
+            encoded.push_back((uint8_t)(end - i - 1));
+            encoded.insert(encoded.end(), deltas.begin() + i, deltas.begin() + end);
+            i = end;
+        }
+
+        encoded.shrink_to_fit();
+        return encoded;
+    }
+
+    void decode(const std::vector<uint8_t> &encoded, uint8_t *destination, size_t size, size_t rowBytes, int pixelBytes)
+    {
+        size_t position = 0;
+        size_t i = 0;
+
+        while (position < encoded.size() && i < size)
+        {
+            uint8_t header = encoded[position++];
+
+            if (header < MAX_PACKET_LENGTH)
+            {
+                size_t length = std::min<size_t>(header + 1, size - i);
+                std::memcpy(destination + i, encoded.data() + position, length);
+                position += header + 1;
+                i += length;
+            }
+            else
+            {
+                size_t length = std::min<size_t>(257 - header, size - i);
+                std::memset(destination + i, encoded[position++], length);
+                i += length;
+            }
+        }
+
+        if (i != size)
+            throw std::runtime_error("Corrupt undo tile");
+
+        // undo the differences, pixel by pixel from the left of each row
+        for (size_t rowStart = 0; rowStart < size; rowStart += rowBytes)
+        {
+            size_t rowEnd = std::min(rowStart + rowBytes, size);
+            for (size_t i = rowStart + pixelBytes; i < rowEnd; i++)
+                destination[i] += destination[i - pixelBytes];
+        }
+    }
+}
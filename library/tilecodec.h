@@ -0,0 +1,15 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Compression of undo tiles. Every byte is replaced by its difference with the same byte of the previous pixel,
+// which turns flat and smooth areas into runs of zeros, then runs are packed PackBits style. Fast enough to run
+// on whole images, and never more than 1/128 larger than the input.
+namespace TileCodec {
+    // Returns the encoded tile, made of rows of rowBytes bytes holding pixels of pixelBytes bytes.
+    std::vector<uint8_t> encode(const uint8_t *tile, size_t size, size_t rowBytes, int pixelBytes);
+
+    // Decodes a tile of size bytes, encoded with the same row and pixel size, into destination.
+    void decode(const std::vector<uint8_t> &encoded, uint8_t *destination, size_t size, size_t rowBytes, int pixelBytes);
+}
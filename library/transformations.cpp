@@ -1,5 +1,7 @@
 #include "transformations.h"
 #include "color.h"
+#include "lookuptable.h"
+#include "simdkernels.h"
 
 namespace PixelTransformations
 {
@@ -54,10 +56,82 @@ namespace PixelTransformations
 
     Pixel blacknwhite(Pixel pixel)
     {
-        int luminance = 0.3*pixel.r + 0.587*pixel.g + 0.114*pixel.b;
-        if (luminance > 127) return Pixel(255, 255, 255);
+        if (pixel.getLuminance() > 127) return Pixel(255, 255, 255);
         else return Pixel(0, 0, 0);
     }
+
+    Pixel apply(TRANSFORM_OPERATION operation, Pixel pixel, int level)
+    {
+        switch (operation)
+        {
+        case OP_BRIGHTNESS:
+            return brightness(pixel, level);
+        case OP_SATURATION:
+            return saturation(pixel, level);
+        case OP_GRAYSCALE:
+            return grayscale(pixel);
+        case OP_NEGATIVE:
+            return negative(pixel);
+        case OP_BLACKNWHITE:
+            return blacknwhite(pixel);
+        }
+        return pixel;
+    }
+}
+
+namespace RowTransformations
+{
+    // The table of the last operation and level used by this thread. It is only observed, so a table dropped from
+    // the compiler cache is freed, not kept alive by every thread that used it.
+    struct CompiledTable
+    {
+        TRANSFORM_OPERATION operation;
+        int level;
+        std::weak_ptr<const LookupTable> table;
+    };
+
+    // Rows of a pass share their operation and level, so the table is compiled once per thread and pass,
+    // instead of every row going through the locked compiler cache
+    static std::shared_ptr<const LookupTable> getTable(TRANSFORM_OPERATION operation, int level)
+    {
+        static thread_local CompiledTable compiled { OP_BRIGHTNESS, 0, {} };
+
+        if (compiled.operation == operation && compiled.level == level)
+        {
+            if (std::shared_ptr<const LookupTable> table = compiled.table.lock())
+                return table;
+        }
+
+        std::shared_ptr<const LookupTable> table = TransformCompiler::compile(operation, level);
+        compiled = CompiledTable { operation, level, table };
+        return table;
+    }
+
+    // Brightness and saturation go through HSV for every pixel, so they run on a cached lookup table instead
+    void brightness(Pixel *row, int width, int level)
+    {
+        getTable(OP_BRIGHTNESS, level)->applyToRow(row, width);
+    }
+
+    void saturation(Pixel *row, int width, int level)
+    {
+        getTable(OP_SATURATION, level)->applyToRow(row, width);
+    }
+
+    void grayscale(Pixel *row, int width)
+    {
+        SimdKernels::grayscale(row, width);
+    }
+
+    void negative(Pixel *row, int width)
+    {
+        SimdKernels::negative(row, width);
+    }
+
+    void blacknwhite(Pixel *row, int width)
+    {
+        SimdKernels::blacknwhite(row, width);
+    }
 }
 
 namespace PixelCombinations {
@@ -87,4 +161,21 @@ namespace PixelCombinations {
         result.b = ((p1.b / 255.0) * (p2.b / 255.0)) * 255;
         return result;
     }
+}
+
+namespace RowCombinations {
+    void add(const Pixel *row1, const Pixel *row2, Pixel *destination, int width)
+    {
+        SimdKernels::add(row1, row2, destination, width);
+    }
+
+    void substract(const Pixel *row1, const Pixel *row2, Pixel *destination, int width)
+    {
+        SimdKernels::substract(row1, row2, destination, width);
+    }
+
+    void multiply(const Pixel *row1, const Pixel *row2, Pixel *destination, int width)
+    {
+        SimdKernels::multiply(row1, row2, destination, width);
+    }
 }
\ No newline at end of file
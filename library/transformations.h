@@ -1,6 +1,16 @@
 #pragma once
 #include "pixel.h"
 
+// Identifies the built-in pixel transformations, for code which has to store or compare them.
+enum TRANSFORM_OPERATION
+{
+    OP_BRIGHTNESS,
+    OP_SATURATION,
+    OP_GRAYSCALE,
+    OP_NEGATIVE,
+    OP_BLACKNWHITE
+};
+
 namespace PixelTransformations {
     // Returns the pixel with adjusted brightness (level -100 to 100).
     Pixel brightness(Pixel pixel, int level);
@@ -19,10 +29,29 @@ namespace PixelTransformations {
 
     // Returns the pixel either fully white or fully black. Uses luminance formula to decide.
     Pixel blacknwhite(Pixel pixel);
+
+    // Returns the pixel transformed by given operation. Level is ignored by operations without one.
+    Pixel apply(TRANSFORM_OPERATION operation, Pixel pixel, int level = 0);
+}
+
+// Whole-row versions of PixelTransformations, meant for Bitmap::transformRows. Same results, without a call per pixel.
+namespace RowTransformations {
+    void brightness(Pixel *row, int width, int level);
+    void saturation(Pixel *row, int width, int level);
+    void grayscale(Pixel *row, int width);
+    void negative(Pixel *row, int width);
+    void blacknwhite(Pixel *row, int width);
 }
 
 namespace PixelCombinations {
     Pixel add(Pixel p1, Pixel p2);
     Pixel substract(Pixel p1, Pixel p2);
     Pixel multiply(Pixel p1, Pixel p2);
+}
+
+// Whole-row versions of PixelCombinations. Destination may be the same row as either of the sources.
+namespace RowCombinations {
+    void add(const Pixel *row1, const Pixel *row2, Pixel *destination, int width);
+    void substract(const Pixel *row1, const Pixel *row2, Pixel *destination, int width);
+    void multiply(const Pixel *row1, const Pixel *row2, Pixel *destination, int width);
 }
\ No newline at end of file
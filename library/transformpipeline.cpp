@@ -0,0 +1,104 @@
+#include "transformpipeline.h"
+#include "channelkernels.h"
+
+namespace {
+    // Brightness and saturation go through HSV for every pixel, the other operations have row kernels
+    bool needsTable(TRANSFORM_OPERATION operation)
+    {
+        return operation == OP_BRIGHTNESS || operation == OP_SATURATION;
+    }
+}
+
+void TransformPipeline::add(TRANSFORM_OPERATION operation, int level)
+{
+    stages.push_back({ operation, level });
+    table.reset();
+}
+
+void TransformPipeline::removeLast()
+{
+    stages.pop_back();
+    table.reset();
+}
+
+void TransformPipeline::clear()
+{
+    stages.clear();
+    table.reset();
+}
+
+bool TransformPipeline::isEmpty() const
+{
+    return stages.empty();
+}
+
+const std::vector<TransformStage> &TransformPipeline::getStages() const
+{
+    return stages;
+}
+
+Pixel TransformPipeline::apply(Pixel pixel) const
+{
+    for (const TransformStage &stage : stages)
+        pixel = PixelTransformations::apply(stage.operation, pixel, stage.level);
+
+    return pixel;
+}
+
+void TransformPipeline::compile()
+{
+    if (table)
+        return;
+
+    bool tableNeeded = false;
+    for (const TransformStage &stage : stages)
+        tableNeeded = tableNeeded || needsTable(stage.operation);
+
+    if (!tableNeeded)
+        return;
+
+    // the table of the whole chain is cached like the ones of single operations, so repeating the chain reuses its colors
+    std::vector<std::pair<TRANSFORM_OPERATION, int>> chain;
+    for (const TransformStage &stage : stages)
+        chain.emplace_back(stage.operation, stage.level);
+
+    table = TransformCompiler::compile(chain);
+}
+
+void TransformPipeline::applyToRow(Pixel *row, int width) const
+{
+    if (table)
+    {
+        table->applyToRow(row, width);
+        return;
+    }
+
+    for (const TransformStage &stage : stages)
+    {
+        switch (stage.operation)
+        {
+        case OP_BRIGHTNESS:
+            RowTransformations::brightness(row, width, stage.level);
+            break;
+        case OP_SATURATION:
+            RowTransformations::saturation(row, width, stage.level);
+            break;
+        case OP_GRAYSCALE:
+            RowTransformations::grayscale(row, width);
+            break;
+        case OP_NEGATIVE:
+            RowTransformations::negative(row, width);
+            break;
+        case OP_BLACKNWHITE:
+            RowTransformations::blacknwhite(row, width);
+            break;
+        }
+    }
+}
+
+void TransformPipeline::applyToChannels(uint16_t *row, int width, int channels, unsigned maxValue) const
+{
+    // 16-bit channels aren't looked up, the kernels run in turn on the row
+    for (const TransformStage &stage : stages)
+        ChannelKernels::apply(stage.operation, row, width, channels, stage.level, maxValue);
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include "lookuptable.h"
+#include "pixel.h"
+#include "transformations.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// A built-in transformation and its level, one step of a TransformPipeline
+struct TransformStage
+{
+    TRANSFORM_OPERATION operation;
+    int level;
+};
+
+// A chain of built-in transformations applied to each row in one go, so the image is read and written once whatever the length of the chain.
+// Chains with an operation going through a lookup table (brightness, saturation) are collapsed into a single table of the whole chain,
+// the others run their row kernels one after another while the row is still in cache.
+class TransformPipeline {
+    public:
+        // Appends a transformation to the chain. Level is ignored by operations without one.
+        void add(TRANSFORM_OPERATION operation, int level = 0);
+
+        // Drops the last transformation of the chain.
+        void removeLast();
+
+        void clear();
+
+        bool isEmpty() const;
+
+        const std::vector<TransformStage>& getStages() const;
+
+        // Returns the pixel transformed by every stage in order.
+        Pixel apply(Pixel pixel) const;
+
+        // Prepares the lookup table of the chain if it needs one. Call it before applying the chain from several threads.
+        void compile();
+
+        // Transforms a row of 8-bit pixels in place, with the same result as applying the stages one by one.
+        void applyToRow(Pixel *row, int width) const;
+
+        // Transforms a row of raw channel values in place, see ChannelKernels.
+        void applyToChannels(uint16_t *row, int width, int channels, unsigned maxValue) const;
+    private:
+        std::vector<TransformStage> stages;
+        // Set by compile, for chains needing a table
+        std::shared_ptr<const LookupTable> table;
+};
@@ -0,0 +1,261 @@
+#include "workerpool.h"
+#include <algorithm>
+#include <chrono>
+#define MIN_BANDS_PER_JOB 64
+#define BANDS_PER_WORKER 4
+#define PROGRESS_POLL_INTERVAL_MS 50
+
+// The pool whose job the current thread works on, the caller of forEachRowBand or one of the workers
+static thread_local const WorkerPool *activePool = nullptr;
+
+namespace {
+// Marks the current thread as working on a job of given pool for its lifetime
+class ActivePoolScope {
+    public:
+        ActivePoolScope(const WorkerPool *pool) : previous(activePool)
+        {
+            activePool = pool;
+        }
+
+        ~ActivePoolScope()
+        {
+            activePool = previous;
+        }
+    private:
+        const WorkerPool *previous;
+};
+}
+
+WorkerPool &WorkerPool::getInstance()
+{
+    static WorkerPool pool;
+    return pool;
+}
+
+WorkerPool::WorkerPool(unsigned count)
+{
+    startWorkers(count);
+}
+
+WorkerPool::~WorkerPool()
+{
+    stopWorkers();
+}
+
+void WorkerPool::setWorkerCount(unsigned count)
+{
+    std::lock_guard<std::mutex> jobLock(jobMutex);
+    stopWorkers();
+    startWorkers(count);
+}
+
+unsigned WorkerPool::getWorkerCount()
+{
+    // the workers can't change while a job of this thread holds the lock
+    if (isInsideJob())
+        return workers.size() + 1;
+
+    std::lock_guard<std::mutex> jobLock(jobMutex);
+    return workers.size() + 1;
+}
+
+bool WorkerPool::isInsideJob() const
+{
+    return activePool == this;
+}
+
+void WorkerPool::forEachRowBand(int rowCount, rowBandFunction bandFunction, std::function<void(int)> progressHandler)
+{
+    if (rowCount <= 0)
+        return;
+
+    // the job lock is already held by this thread, or by the caller waiting for this worker
+    if (isInsideJob())
+    {
+        runInline(rowCount, bandFunction, progressHandler);
+        return;
+    }
+
+    std::lock_guard<std::mutex> jobLock(jobMutex);
+    ActivePoolScope scope(this);
+
+    std::shared_ptr<Job> job = std::make_shared<Job>();
+    int targetBandCount = std::max<int>(MIN_BANDS_PER_JOB, (workers.size() + 1) * BANDS_PER_WORKER);
+
+    job->function = bandFunction;
+    job->rowCount = rowCount;
+    job->bandSize = std::max(1, (rowCount + targetBandCount - 1) / targetBandCount);
+    job->bandCount = (rowCount + job->bandSize - 1) / job->bandSize;
+
+    if (!workers.empty())
+    {
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            currentJob = job;
+            jobGeneration++;
+        }
+        jobAvailable.notify_all();
+    }
+
+    waitForJob(*job, progressHandler);
+
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        currentJob.reset();
+    }
+
+    if (job->exception)
+        std::rethrow_exception(job->exception);
+}
+
+void WorkerPool::waitForJob(Job &job, std::function<void(int)> &progressHandler)
+{
+    int lastProgress = -1;
+
+    auto reportProgress = [&]() {
+        int progress = (long long)job.finishedRows * 100 / job.rowCount;
+        if (progressHandler && progress != lastProgress && !job.cancelled)
+        {
+            lastProgress = progress;
+            try
+            {
+                progressHandler(progress);
+            }
+            catch (...)
+            {
+                // workers still reference the job, so cancel it and let it drain before rethrowing
+                std::lock_guard<std::mutex> lock(job.exceptionMutex);
+                if (!job.exception)
+                    job.exception = std::current_exception();
+                job.cancelled = true;
+            }
+        }
+    };
+
+    // the calling thread works on the job too, reporting progress between its bands
+    while (runNextBand(job))
+        reportProgress();
+
+    std::unique_lock<std::mutex> lock(stateMutex);
+    while (job.finishedBands < job.bandCount)
+    {
+        jobFinished.wait_for(lock, std::chrono::milliseconds(PROGRESS_POLL_INTERVAL_MS));
+        lock.unlock();
+        reportProgress();
+        lock.lock();
+    }
+}
+
+void WorkerPool::runInline(int rowCount, rowBandFunction &bandFunction, std::function<void(int)> &progressHandler)
+{
+    int bandSize = std::max(1, (rowCount + MIN_BANDS_PER_JOB - 1) / MIN_BANDS_PER_JOB);
+    int lastProgress = -1;
+
+    for (int firstRow = 0; firstRow < rowCount; firstRow += bandSize)
+    {
+        int lastRow = std::min(rowCount, firstRow + bandSize);
+        bandFunction(firstRow, lastRow);
+
+        int progress = (long long)lastRow * 100 / rowCount;
+        if (progressHandler && progress != lastProgress)
+        {
+            lastProgress = progress;
+            progressHandler(progress);
+        }
+    }
+}
+
+bool WorkerPool::runNextBand(Job &job)
+{
+    int band = job.nextBand.fetch_add(1);
+    if (band >= job.bandCount)
+        return false;
+
+    int firstRow = band * job.bandSize;
+    int lastRow = std::min(job.rowCount, firstRow + job.bandSize);
+
+    if (!job.cancelled)
+    {
+        try
+        {
+            job.function(firstRow, lastRow);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(job.exceptionMutex);
+            if (!job.exception)
+                job.exception = std::current_exception();
+            job.cancelled = true;
+        }
+    }
+
+    job.finishedRows += lastRow - firstRow;
+
+    if (job.finishedBands.fetch_add(1) + 1 == job.bandCount)
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        jobFinished.notify_all();
+    }
+
+    return true;
+}
+
+void WorkerPool::startWorkers(unsigned count)
+{
+    if (count == 0)
+        count = std::max(1u, std::thread::hardware_concurrency());
+
+    stopping = false;
+
+    for (unsigned i = 1; i < count; i++)
+        workers.emplace_back(&WorkerPool::workerLoop, this);
+}
+
+void WorkerPool::stopWorkers()
+{
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        stopping = true;
+    }
+    jobAvailable.notify_all();
+
+    for (std::thread &worker : workers)
+        worker.join();
+
+    workers.clear();
+}
+
+void WorkerPool::workerLoop()
+{
+    // workers only ever run bands of a job
+    ActivePoolScope scope(this);
+    unsigned long seenGeneration;
+
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        seenGeneration = jobGeneration;
+    }
+
+    while (true)
+    {
+        std::shared_ptr<Job> job;
+
+        {
+            std::unique_lock<std::mutex> lock(stateMutex);
+            jobAvailable.wait(lock, [&] { return stopping || jobGeneration != seenGeneration; });
+
+            if (stopping)
+                return;
+
+            seenGeneration = jobGeneration;
+            job = currentJob;
+        }
+
+        if (job)
+        {
+            while (runNextBand(*job))
+            {
+            }
+        }
+    }
+}
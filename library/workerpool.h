@@ -0,0 +1,78 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+typedef std::function<void(int, int)> rowBandFunction;
+
+// A pool of worker threads, which runs jobs split into bands of rows. The calling thread takes part in the work,
+// and is the only one that reports the progress, so progress handlers never run on a worker thread.
+// Only one job runs at a time. A job started from inside another job of the same pool, by a band function or a
+// progress handler, runs inline on the calling thread instead of waiting for the outer job, which it would never see end.
+class WorkerPool {
+    public:
+        // Returns the pool shared by the whole library.
+        static WorkerPool &getInstance();
+
+        // Sets the number of threads working on a job, including the calling thread. 0 means one per hardware thread.
+        // Waits for the running job, so it must not be called from inside a job of this pool.
+        void setWorkerCount(unsigned count);
+
+        // Returns the number of threads working on a job, including the calling thread.
+        unsigned getWorkerCount();
+
+        // Calls bandFunction(firstRow, lastRow) for bands covering rows [0, rowCount), and blocks until all are done.
+        // Bands may run concurrently, so bandFunction must be safe to call from several threads.
+        // Exceptions thrown by bandFunction cancel the remaining bands and are rethrown here.
+        // Called from inside a job of this pool, the bands run one after another on the calling thread.
+        void forEachRowBand(int rowCount, rowBandFunction bandFunction, std::function<void(int)> progressHandler = nullptr);
+
+        // Returns if the calling thread works on a job of this pool, as the caller of forEachRowBand (its progress handler
+        // included) or running a band.
+        bool isInsideJob() const;
+
+        // Creates a pool of given size. 0 means one thread per hardware thread.
+        WorkerPool(unsigned count = 0);
+
+        WorkerPool(const WorkerPool&) = delete;
+        WorkerPool& operator=(const WorkerPool&) = delete;
+
+        ~WorkerPool();
+    private:
+        // A single forEachRowBand call, shared with the workers taking part in it.
+        struct Job {
+            rowBandFunction function;
+            int rowCount = 0;
+            int bandSize = 1;
+            int bandCount = 0;
+            std::atomic<int> nextBand { 0 };
+            std::atomic<int> finishedBands { 0 };
+            std::atomic<int> finishedRows { 0 };
+            std::atomic<bool> cancelled { false };
+            std::mutex exceptionMutex;
+            std::exception_ptr exception;
+        };
+
+        void startWorkers(unsigned count);
+        void stopWorkers();
+        void workerLoop();
+        bool runNextBand(Job &job);
+        void waitForJob(Job &job, std::function<void(int)> &progressHandler);
+        void runInline(int rowCount, rowBandFunction &bandFunction, std::function<void(int)> &progressHandler);
+
+        std::vector<std::thread> workers;
+        // Held for the whole job, so only one job runs at a time
+        std::mutex jobMutex;
+        // Guards currentJob, jobGeneration and stopping
+        std::mutex stateMutex;
+        std::condition_variable jobAvailable;
+        std::condition_variable jobFinished;
+        std::shared_ptr<Job> currentJob;
+        unsigned long jobGeneration = 0;
+        bool stopping = false;
+};
@@ -0,0 +1,71 @@
+// Checks the bulk HSV conversions against the per-pixel ones over every RGB color.
+#include "color.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+// The bulk conversions round in fixed point where the per-pixel ones truncate floats, truncating the hue and then
+// the channels, so a channel may come out up to 2 apart
+const int MAX_CHANNEL_DIFFERENCE = 2;
+const float MAX_SATURATION_DIFFERENCE = 1.0f / 65535;
+
+int failures = 0;
+
+void expect(bool condition, const char *check, Pixel pixel)
+{
+    // reports the first few colors only, a broken conversion fails for millions of them
+    if (!condition && failures++ < 10)
+        std::printf("  %s fails for (%d, %d, %d)\n", check, pixel.r, pixel.g, pixel.b);
+}
+
+int channelDifference(Pixel p1, RGBColor p2)
+{
+    return std::max(std::abs(p1.r - p2.r), std::max(std::abs(p1.g - p2.g), std::abs(p1.b - p2.b)));
+}
+} // namespace
+
+int main()
+{
+    // one red value at a time, 65536 colors per batch
+    const size_t count = 256 * 256;
+    std::vector<Pixel> pixels(count);
+    std::vector<HSVColor> colors(count);
+    std::vector<Pixel> converted(count);
+    std::vector<Pixel> convertedFromPlanes(count);
+    HSVPlanes planes(count);
+
+    for (int r = 0; r < 256; r++)
+    {
+        for (int g = 0; g < 256; g++)
+            for (int b = 0; b < 256; b++)
+                pixels[g * 256 + b] = Pixel(r, g, b);
+
+        Conversions::RGBToHSV(pixels.data(), colors.data(), count);
+        Conversions::RGBToHSV(pixels.data(), planes, count);
+        Conversions::HSVToRGB(colors.data(), converted.data(), count);
+        Conversions::HSVToRGB(planes, convertedFromPlanes.data(), count);
+
+        for (size_t i = 0; i < count; i++)
+        {
+            Pixel pixel = pixels[i];
+            HSVColor expected = Conversions::RGBToHSV(pixel);
+            RGBColor expectedBack = Conversions::HSVToRGB(expected);
+
+            expect(colors[i].hue == expected.hue, "hue", pixel);
+            expect(std::fabs(colors[i].saturation - expected.saturation) <= MAX_SATURATION_DIFFERENCE, "saturation", pixel);
+            expect(colors[i].brightness == expected.brightness, "brightness", pixel);
+
+            expect(planes.hue[i] == expected.hue, "planar hue", pixel);
+            expect(std::fabs(planes.saturation[i] / 65535.0f - expected.saturation) <= MAX_SATURATION_DIFFERENCE, "planar saturation", pixel);
+            expect(planes.brightness[i] == expected.brightness, "planar brightness", pixel);
+
+            expect(channelDifference(converted[i], expectedBack) <= MAX_CHANNEL_DIFFERENCE, "HSV to RGB", pixel);
+            expect(channelDifference(convertedFromPlanes[i], expectedBack) <= MAX_CHANNEL_DIFFERENCE, "planar HSV to RGB", pixel);
+        }
+    }
+
+    std::printf("%s\n", failures == 0 ? "ok" : "FAILED");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,189 @@
+// Checks the vectorized kernels of every instruction set supported by this CPU against the per-pixel functions.
+#include "simdkernels.h"
+#include "transformations.h"
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace {
+int failures = 0;
+
+const char *getName(SimdKernels::INSTRUCTION_SET instructionSet)
+{
+    switch (instructionSet)
+    {
+    case SimdKernels::SCALAR:
+        return "scalar";
+    case SimdKernels::SSE2:
+        return "SSE2";
+    case SimdKernels::AVX2:
+        return "AVX2";
+    }
+    return "unknown";
+}
+
+void expectEqualRows(const char *kernel, int width, const Pixel *actual, const Pixel *expected, int count)
+{
+    for (int x = 0; x < count; x++)
+    {
+        if (actual[x].r != expected[x].r || actual[x].g != expected[x].g || actual[x].b != expected[x].b)
+        {
+            std::printf("  %s, width %d: pixel %d is (%d, %d, %d), expected (%d, %d, %d)\n", kernel, width, x,
+                        actual[x].r, actual[x].g, actual[x].b, expected[x].r, expected[x].g, expected[x].b);
+            failures++;
+            return;
+        }
+    }
+}
+
+std::vector<Pixel> randomRow(std::mt19937 &random, int width)
+{
+    std::vector<Pixel> row(width);
+    for (Pixel &pixel : row)
+        pixel = Pixel(random() & 0xFF, random() & 0xFF, random() & 0xFF);
+    return row;
+}
+
+// Rows holding every pair of channel values, so the combinations are checked over all their inputs
+void allValuePairs(std::vector<Pixel> &row1, std::vector<Pixel> &row2)
+{
+    row1.clear();
+    row2.clear();
+    for (int a = 0; a < 256; a++)
+    {
+        for (int b = 0; b < 256; b++)
+        {
+            row1.push_back(Pixel(a, b, 255 - a));
+            row2.push_back(Pixel(b, a, 255 - b));
+        }
+    }
+}
+
+// Colors right on the black and white treshold, a luminance of exactly 128
+std::vector<Pixel> tresholdColors()
+{
+    std::vector<Pixel> row;
+    for (int r = 0; r < 256; r++)
+        for (int g = 0; g < 256; g++)
+            for (int b = 0; b < 256; b++)
+                if (300 * r + 587 * g + 114 * b == 128000)
+                    row.push_back(Pixel(r, g, b));
+    return row;
+}
+
+void checkTransformation(const char *kernel, void (*rowKernel)(Pixel *, int), Pixel (*pixelFunction)(Pixel),
+                         const std::vector<Pixel> &source)
+{
+    std::vector<Pixel> expected(source.size());
+    for (size_t x = 0; x < source.size(); x++)
+        expected[x] = pixelFunction(source[x]);
+
+    std::vector<Pixel> row = source;
+    rowKernel(row.data(), row.size());
+    expectEqualRows(kernel, row.size(), row.data(), expected.data(), row.size());
+}
+
+void checkCombination(const char *kernel, void (*rowKernel)(const Pixel *, const Pixel *, Pixel *, int),
+                      Pixel (*pixelFunction)(Pixel, Pixel), const std::vector<Pixel> &row1, const std::vector<Pixel> &row2)
+{
+    int width = row1.size();
+    std::vector<Pixel> expected(width);
+    for (int x = 0; x < width; x++)
+        expected[x] = pixelFunction(row1[x], row2[x]);
+
+    std::vector<Pixel> destination(width);
+    rowKernel(row1.data(), row2.data(), destination.data(), width);
+    expectEqualRows(kernel, width, destination.data(), expected.data(), width);
+
+    // in place over either source
+    std::vector<Pixel> first = row1;
+    rowKernel(first.data(), row2.data(), first.data(), width);
+    expectEqualRows(kernel, width, first.data(), expected.data(), width);
+
+    std::vector<Pixel> second = row2;
+    rowKernel(row1.data(), second.data(), second.data(), width);
+    expectEqualRows(kernel, width, second.data(), expected.data(), width);
+}
+
+void checkDownsample(const std::vector<Pixel> &row1, const std::vector<Pixel> &row2)
+{
+    int width = row1.size() / 2;
+    std::vector<Pixel> expected(width);
+    for (int x = 0; x < width; x++)
+    {
+        const Pixel *top = row1.data() + 2 * x;
+        const Pixel *bottom = row2.data() + 2 * x;
+        expected[x] = Pixel((top[0].r + top[1].r + bottom[0].r + bottom[1].r + 2) / 4,
+                            (top[0].g + top[1].g + bottom[0].g + bottom[1].g + 2) / 4,
+                            (top[0].b + top[1].b + bottom[0].b + bottom[1].b + 2) / 4);
+    }
+
+    // one pixel past the end, which must be left alone
+    std::vector<Pixel> destination(width + 1, Pixel(1, 2, 3));
+    SimdKernels::downsample(row1.data(), row2.data(), destination.data(), width);
+    expectEqualRows("downsample", width, destination.data(), expected.data(), width);
+
+    Pixel guard = Pixel(1, 2, 3);
+    expectEqualRows("downsample past the end", width, destination.data() + width, &guard, 1);
+}
+
+void checkRows(const std::vector<Pixel> &row1, const std::vector<Pixel> &row2)
+{
+    checkTransformation("negative", SimdKernels::negative, PixelTransformations::negative, row1);
+    checkTransformation("grayscale", SimdKernels::grayscale, PixelTransformations::grayscale, row1);
+    checkTransformation("blacknwhite", SimdKernels::blacknwhite, PixelTransformations::blacknwhite, row1);
+    checkCombination("add", SimdKernels::add, PixelCombinations::add, row1, row2);
+    checkCombination("substract", SimdKernels::substract, PixelCombinations::substract, row1, row2);
+    checkCombination("multiply", SimdKernels::multiply, PixelCombinations::multiply, row1, row2);
+}
+} // namespace
+
+int main()
+{
+    const SimdKernels::INSTRUCTION_SET instructionSets[] = { SimdKernels::SCALAR, SimdKernels::SSE2, SimdKernels::AVX2 };
+    SimdKernels::INSTRUCTION_SET supported = SimdKernels::getSupportedInstructionSet();
+    std::mt19937 random(12345);
+
+    for (SimdKernels::INSTRUCTION_SET instructionSet : instructionSets)
+    {
+        if (instructionSet > supported)
+        {
+            std::printf("%s: not supported by this CPU, skipped\n", getName(instructionSet));
+            continue;
+        }
+
+        SimdKernels::setInstructionSet(instructionSet);
+        std::printf("%s\n", getName(instructionSet));
+        int failuresBefore = failures;
+
+        // every width around the vector sizes, so the scalar tails are covered too
+        for (int width = 0; width <= 100; width++)
+        {
+            std::vector<Pixel> row1 = randomRow(random, width);
+            std::vector<Pixel> row2 = randomRow(random, width);
+            checkRows(row1, row2);
+
+            std::vector<Pixel> sourceRow1 = randomRow(random, 2 * width);
+            std::vector<Pixel> sourceRow2 = randomRow(random, 2 * width);
+            checkDownsample(sourceRow1, sourceRow2);
+        }
+
+        std::vector<Pixel> row1, row2;
+        allValuePairs(row1, row2);
+        checkRows(row1, row2);
+        checkDownsample(row1, row2);
+
+        std::vector<Pixel> treshold = tresholdColors();
+        checkTransformation("blacknwhite on the treshold", SimdKernels::blacknwhite, PixelTransformations::blacknwhite, treshold);
+
+        // an odd width, so the whole vectors end mid pixel
+        row1.resize(row1.size() - 1);
+        row2.resize(row2.size() - 1);
+        checkRows(row1, row2);
+
+        std::printf("  %s\n", failures == failuresBefore ? "ok" : "FAILED");
+    }
+
+    return failures == 0 ? 0 : 1;
+}